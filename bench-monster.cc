@@ -0,0 +1,323 @@
+/**
+ * @file bench-monster.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Time each phase of a monster query over a fixed corpus: crawl
+ * initialisation, name parsing, vault lookups, trial sampling, spell set
+ * construction, report formatting and whole queries.
+ *
+ * This includes monster-main.cc itself (without its main()) so that the
+ * phases can be called directly. Results are printed one line per phase
+ * and monster, in a fixed order and format, so that the output of two
+ * builds can be diffed:
+ *
+ *   phase name samples median_us p90_us p99_us allocs/op bytes/op
+ *
+**/
+
+#define MONSTER_NO_MAIN
+#include "monster-main.cc"
+
+#include <new>
+#include <time.h>
+
+// Operator new calls and bytes, counted by the replacements below.
+static unsigned long alloc_count = 0;
+static unsigned long alloc_bytes = 0;
+
+void *operator new(size_t size)
+{
+    ++alloc_count;
+    alloc_bytes += size;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static const char *corpus[] = {
+    "rat",
+    "quasit",
+    "lich",
+    "pandemonium lord",
+    "draconian",
+    "black draconian",
+    "draconian scorcher",
+};
+
+// Misspelt on purpose.
+#define TYPO_NAME "quasti"
+
+#define SAMPLE_TRIALS 100
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+struct bench_result
+{
+    std::vector<double> times;
+    unsigned long allocs;
+    unsigned long bytes;
+
+    bench_result() : allocs(0), bytes(0) { }
+};
+
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    const unsigned int i = fraction * (sorted.size() - 1) + 0.5;
+    return sorted[std::min<unsigned int>(i, sorted.size() - 1)];
+}
+
+static void print_result(const char *phase, const std::string &name,
+                         bench_result result)
+{
+    std::sort(result.times.begin(), result.times.end());
+    const unsigned int n = result.times.size();
+    printf("%-18s %-22s %5u %12.2f %12.2f %12.2f %10.1f %12.1f\n",
+           phase, name.c_str(), n,
+           percentile(result.times, 0.5), percentile(result.times, 0.9),
+           percentile(result.times, 0.99),
+           n ? (double) result.allocs / n : 0.0,
+           n ? (double) result.bytes / n : 0.0);
+    fflush(stdout);
+}
+
+/**
+ * Time iterations runs of op. setup, if given, runs untimed (and
+ * uncounted) before each one.
+**/
+static bench_result bench(int iterations, std::function<void ()> op,
+                          std::function<void ()> setup = nullptr)
+{
+    bench_result result;
+    for (int i = 0; i < iterations; ++i)
+    {
+        if (setup)
+            setup();
+
+        const unsigned long allocs = alloc_count, bytes = alloc_bytes;
+        const double start = now_us();
+        op();
+        result.times.push_back(now_us() - start);
+        result.allocs += alloc_count - allocs;
+        result.bytes += alloc_bytes - bytes;
+    }
+    return result;
+}
+
+static bool parse_spec(const std::string &name, mons_spec &spec)
+{
+    mons_list mons;
+    if (!mons.add_mons(name, false).empty())
+        return false;
+    spec = mons.get_monster(0);
+    return spec.type >= 0 && spec.type < NUM_MONSTERS;
+}
+
+static void bench_sampling(const std::string &name, int iterations)
+{
+    mons_spec spec;
+    if (!parse_spec(name, spec))
+        return;
+    const monster_type spec_type = static_cast<monster_type>(spec.type);
+
+    print_result("sample_100", name, bench(iterations,
+        [&]()
+        {
+            std::string target = name;
+            std::string report;
+            trial_stats stats;
+            int index = mi_create_monster(spec);
+            if (index >= 0 && index < MAX_MONSTERS)
+            {
+                sample_trials(index, spec, target, spec_type, SAMPLE_TRIALS,
+                              SAMPLE_TRIALS, stats, report);
+            }
+        },
+        []()
+        {
+            sandbox_restore();
+            damage_cache.clear();
+            seed_rng(1);
+        }));
+    sandbox_restore();
+}
+
+static void bench_spells(const std::string &name, int iterations)
+{
+    mons_spec spec;
+    if (!parse_spec(name, spec))
+        return;
+
+    seed_rng(1);
+    const int index = mi_create_monster(spec);
+    if (index < 0 || index >= MAX_MONSTERS)
+        return;
+    monster *mp = &menv[index];
+    if (mp->spells.empty())
+    {
+        sandbox_restore();
+        return;
+    }
+
+    std::set<spell_set> spells;
+    spell_damage_map damages;
+    print_result("record_spell_set", name, bench(iterations,
+        [&]()
+        {
+            spell_set set;
+            record_spell_set(mp, set, damages);
+            spells.insert(set);
+        },
+        [&]()
+        {
+            damage_cache.clear();
+            damages.clear();
+        }));
+
+    print_result("construct_spells", name, bench(iterations,
+        [&]() { construct_spells(mp, spells, damages); }));
+
+    sandbox_restore();
+}
+
+static void bench_formatting(const std::string &name, int iterations)
+{
+    std::string report;
+    monster_report rep;
+    seed_rng(1);
+    const int status = monster_query(name, report, &rep);
+    sandbox_restore();
+    if (status)
+        return;
+
+    std::string out;
+    print_result("format_text", name, bench(iterations,
+        [&]()
+        {
+            out.clear();
+            emit_report(rep, REPORT_TEXT, false, false, out);
+        }));
+    print_result("format_json", name, bench(iterations,
+        [&]()
+        {
+            out.clear();
+            emit_report(rep, REPORT_JSON, false, false, out);
+        }));
+}
+
+// Time the query in-process: run_isolated_query would time a fork and
+// count only the parent's allocations.
+static void bench_query(const std::string &name, int iterations)
+{
+    print_result("query", name, bench(iterations,
+        [&]()
+        {
+            std::string report;
+            live_query(name, report);
+        },
+        []()
+        {
+            sandbox_restore();
+            seed_rng(1);
+        }));
+    sandbox_restore();
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 200;
+    int sample_iterations = 10;
+    for (int arg = 1; arg < argc; ++arg)
+    {
+        if (is_option(argv[arg], "quick"))
+        {
+            iterations = 20;
+            sample_iterations = 2;
+        }
+        else
+        {
+            printf("Usage: %s [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    crawl_state.test = true;
+    // Fix the colour backend so that formatting times don't depend on
+    // whether stdout is a terminal.
+    set_report_colour(COLOUR_IRC);
+
+    printf("# monster-bench %s\n", Version::Long);
+    printf("%-18s %-22s %5s %12s %12s %12s %10s %12s\n",
+           "# phase", "name", "n", "median_us", "p90_us", "p99_us",
+           "allocs/op", "bytes/op");
+
+    print_result("initialize_crawl", "-", bench(1, initialize_crawl));
+
+    std::vector<std::string> names(corpus, corpus + ARRAYSZ(corpus));
+
+    const vault_pack &pack = current_vault_pack();
+    std::string vault_name;
+    if (pack.index_count() > 0)
+    {
+        // The middle of the index, so it isn't an edge case of the search.
+        vault_name = pack.index_name(pack.index_count() / 2);
+        printf("# vault monster: %s\n", vault_name.c_str());
+    }
+    else
+        printf("# vault monster: none (no vault pack index)\n");
+
+    for (unsigned int i = 0; i < names.size(); ++i)
+    {
+        print_result("add_mons", names[i], bench(iterations,
+            [&]()
+            {
+                mons_list mons;
+                mons.add_mons(names[i], false);
+            }));
+    }
+    print_result("add_mons", TYPO_NAME, bench(iterations,
+        []()
+        {
+            mons_list mons;
+            mons.add_mons(TYPO_NAME, false);
+        }));
+
+    if (!vault_name.empty())
+    {
+        print_result("vault_hit", vault_name, bench(iterations,
+            [&]() { get_vault_monster(vault_name); }));
+    }
+    print_result("vault_miss", TYPO_NAME, bench(iterations,
+        []() { get_vault_monster(TYPO_NAME); }));
+
+    for (unsigned int i = 0; i < names.size(); ++i)
+        bench_sampling(names[i], sample_iterations);
+
+    for (unsigned int i = 0; i < names.size(); ++i)
+        bench_spells(names[i], iterations);
+
+    if (!vault_name.empty())
+        names.push_back(vault_name);
+
+    for (unsigned int i = 0; i < names.size(); ++i)
+        bench_formatting(names[i], iterations);
+
+    names.push_back(TYPO_NAME);
+    for (unsigned int i = 0; i < names.size(); ++i)
+        bench_query(names[i], sample_iterations);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file deadline.cc
+ *
+ * @section DESCRIPTION
+ *
+ * The query time budget (see deadline.h).
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "deadline.h"
+
+#include <algorithm>
+#include <climits>
+#include <time.h>
+
+static int budget = 0;
+static double expires = 0;
+
+double monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * Give the current query budget_ms milliseconds from now; 0 for no limit.
+ *
+**/
+void deadline_start(int budget_ms)
+{
+    budget = std::max(0, budget_ms);
+    expires = budget ? monotonic_ms() + budget : 0;
+}
+
+void deadline_clear()
+{
+    deadline_start(0);
+}
+
+bool deadline_active()
+{
+    return budget > 0;
+}
+
+int deadline_budget_ms()
+{
+    return budget;
+}
+
+// Time left before the deadline, or INT_MAX if there is none.
+double deadline_remaining_ms()
+{
+    return budget ? expires - monotonic_ms() : INT_MAX;
+}
+
+bool deadline_expired()
+{
+    return deadline_remaining_ms() <= 0;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file deadline.h
+ *
+ * @section DESCRIPTION
+ *
+ * The --deadline time budget of the current query. Long-running loops
+ * (sampling trials, scanning vault specs) check it and stop early, so a
+ * slow query gives a less precise answer rather than being killed by the
+ * alarm. Forked workers inherit the deadline of their parent.
+ *
+**/
+
+#ifndef __DEADLINE_H__
+#define __DEADLINE_H__
+
+#include "AppHdr.h"
+
+double monotonic_ms();
+
+void deadline_start(int budget_ms);
+void deadline_clear();
+
+bool deadline_active();
+int deadline_budget_ms();
+double deadline_remaining_ms();
+bool deadline_expired();
+
+#endif
@@ -0,0 +1,481 @@
+/**
+ * @file des_scan.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Monster specs turn up in three places in a .des file:
+ *
+ *   - MONS: and KMONS: lines (with \ continuations);
+ *   - mons() and kmons() calls in Lua code;
+ *   - the monster set tables of the sprint maps.
+ *
+ * Lua comments and # comment lines are dropped first. Only specs with a
+ * name are kept, since unnamed vault monsters can't be told apart from
+ * ordinary ones.
+ *
+ * The cache is a text file:
+ *
+ *     des-scan-cache 1
+ *     specs <hash of the sorted spec list>
+ *     file <hash of the file's contents> <number of specs>
+ *     <one spec per line>
+ *     ...
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "des_scan.h"
+#include "file_util.h"
+#include "stringutil.h"
+
+#include <algorithm>
+#include <atomic>
+#include <dirent.h>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+
+#define DES_CACHE_HEADER "des-scan-cache 1"
+
+// These des files are ignored.
+static const char *ignore_des_files[] = { "test.des" };
+
+// Any des file under these subfolders is ignored.
+static const char *ignore_des_subfolders[] = { "builder", "zotdef",
+                                               "tutorial" };
+
+static bool in_list(const std::string &name, const char **list, int size)
+{
+    for (int i = 0; i < size; ++i)
+        if (name == list[i])
+            return true;
+    return false;
+}
+
+static bool is_identifier_char(char c)
+{
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+// Collapse whitespace runs to a single space and trim.
+static std::string collapse_whitespace(const std::string &s)
+{
+    std::string out;
+    bool space = false;
+    for (unsigned int i = 0; i < s.size(); ++i)
+    {
+        if (isspace((unsigned char) s[i]))
+            space = true;
+        else
+        {
+            if (space && !out.empty())
+                out += ' ';
+            space = false;
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+// Remove MONS: and KMONS: prefixes, and a KMONS glyph assignment.
+static std::string cleanup_mons_line(std::string line)
+{
+    trim_string(line);
+    if (line.compare(0, 6, "KMONS:") == 0)
+        line = line.substr(line.rfind('=') + 1);
+    line = replace_all(line, "MONS:", "");
+    return collapse_whitespace(line);
+}
+
+// Split a MONS: line (or a Lua mons() argument) into its monsters.
+static void parse_mons_line(const std::string &line,
+                            std::vector<std::string> &specs)
+{
+    const std::string cleaned = cleanup_mons_line(line);
+
+    std::string::size_type start = 0;
+    while (start <= cleaned.size())
+    {
+        std::string::size_type end = cleaned.find_first_of("/,", start);
+        if (end == std::string::npos)
+            end = cleaned.size();
+
+        std::string mons = cleaned.substr(start, end - start);
+        const std::string::size_type semicolon = mons.find("; ");
+        if (semicolon != std::string::npos)
+            mons.erase(semicolon);
+        specs.push_back(cleanup_mons_line(mons));
+
+        start = end + 1;
+    }
+}
+
+/**
+ * Collect the string literals between pos and the end of the enclosing
+ * parenthesised (or, if brace is set, braced) list.
+ *
+ * @return The position after the end of the list.
+ *
+**/
+static std::string::size_type read_string_literals(
+    const std::string &text, std::string::size_type pos, bool brace,
+    std::vector<std::string> &strings)
+{
+    const char open = brace ? '{' : '(', close = brace ? '}' : ')';
+    int depth = 0;
+    while (pos < text.size())
+    {
+        const char c = text[pos];
+        if (c == '"' || c == '\'')
+        {
+            std::string literal;
+            for (++pos; pos < text.size() && text[pos] != c; ++pos)
+            {
+                if (text[pos] == '\\' && pos + 1 < text.size())
+                    ++pos;
+                literal += text[pos];
+            }
+            strings.push_back(literal);
+        }
+        else if (c == open)
+            ++depth;
+        else if (c == close && --depth <= 0)
+            return pos + 1;
+        ++pos;
+    }
+    return pos;
+}
+
+// mons("...") and kmons("...") calls, with any amount of whitespace before
+// the bracket and any number of arguments.
+static void find_lua_mons(const std::string &text,
+                          std::vector<std::string> &specs)
+{
+    std::string::size_type pos = 0;
+    while ((pos = text.find("mons", pos)) != std::string::npos)
+    {
+        const bool kmons = pos > 0 && text[pos - 1] == 'k';
+        const std::string::size_type name_start = kmons ? pos - 1 : pos;
+        pos += 4;
+        if (name_start > 0 && is_identifier_char(text[name_start - 1])
+            || pos < text.size() && is_identifier_char(text[pos]))
+        {
+            continue;
+        }
+
+        std::string::size_type bracket = pos;
+        while (bracket < text.size() && isspace((unsigned char) text[bracket]))
+            ++bracket;
+        if (bracket >= text.size() || text[bracket] != '(')
+            continue;
+
+        std::vector<std::string> args;
+        pos = read_string_literals(text, bracket, false, args);
+        for (unsigned int i = 0; i < args.size(); ++i)
+        {
+            std::string arg = args[i];
+            trim_string(arg);
+            if (arg == "nothing")
+                continue;
+            parse_mons_line(kmons ? "KMONS:" + arg : arg, specs);
+        }
+    }
+}
+
+/**
+ * Does a sprint monster set assignment (bs[N] =, mon_set = or
+ * local name =) start at pos?
+ *
+ * @return The position of its first string literal, or npos.
+ *
+**/
+static std::string::size_type sprint_set_start(const std::string &text,
+                                               std::string::size_type pos)
+{
+    std::string::size_type end = pos;
+    if (text.compare(pos, 3, "bs[") == 0)
+    {
+        end = pos + 3;
+        while (end < text.size() && isdigit((unsigned char) text[end]))
+            ++end;
+        if (end == pos + 3 || end >= text.size() || text[end] != ']')
+            return std::string::npos;
+        ++end;
+    }
+    else if (text.compare(pos, 7, "mon_set") == 0)
+        end = pos + 7;
+    else if (text.compare(pos, 6, "local ") == 0)
+    {
+        end = pos + 6;
+        while (end < text.size() && is_identifier_char(text[end]))
+            ++end;
+        if (end == pos + 6)
+            return std::string::npos;
+    }
+    else
+        return std::string::npos;
+
+    if (text.compare(end, 2, " =") != 0)
+        return std::string::npos;
+    end += 2;
+    if (text.compare(end, 2, " {") == 0)
+        end += 2;
+    while (end < text.size() && isspace((unsigned char) text[end]))
+        ++end;
+    return end < text.size() && text[end] == '"' ? end : std::string::npos;
+}
+
+static void find_sprint_sets(const std::string &text,
+                             std::vector<std::string> &specs)
+{
+    for (std::string::size_type pos = 0; pos < text.size(); ++pos)
+    {
+        const std::string::size_type start = sprint_set_start(text, pos);
+        if (start == std::string::npos)
+            continue;
+
+        std::vector<std::string> monsters;
+        pos = read_string_literals(text, start, true, monsters) - 1;
+        for (unsigned int i = 0; i < monsters.size(); ++i)
+            parse_mons_line(monsters[i], specs);
+    }
+}
+
+/**
+ * Find the named monster specs in the text of a .des file.
+ *
+ * @param des_text The whole file.
+ * @return The specs in the order found; may contain duplicates.
+ *
+**/
+std::vector<std::string> des_monster_specs(const std::string &des_text)
+{
+    // Drop comments and blank lines, then join continued lines.
+    std::string text;
+    std::string::size_type start = 0;
+    while (start < des_text.size())
+    {
+        std::string::size_type end = des_text.find('\n', start);
+        if (end == std::string::npos)
+            end = des_text.size();
+        std::string line = des_text.substr(start, end - start);
+        start = end + 1;
+
+        const std::string::size_type comment = line.find("--");
+        if (comment != std::string::npos)
+            line.erase(comment);
+        trim_string(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        if (line[line.size() - 1] == '\\')
+            text += line.substr(0, line.size() - 1);
+        else
+            text += line + "\n";
+    }
+
+    std::vector<std::string> specs;
+    start = 0;
+    while (start < text.size())
+    {
+        const std::string::size_type end = text.find('\n', start);
+        const std::string line = text.substr(start, end - start);
+        if (line.compare(0, 5, "MONS:") == 0
+            || line.compare(0, 6, "KMONS:") == 0)
+        {
+            parse_mons_line(line, specs);
+        }
+        start = end + 1;
+    }
+    find_lua_mons(text, specs);
+    find_sprint_sets(text, specs);
+
+    std::vector<std::string> named;
+    for (unsigned int i = 0; i < specs.size(); ++i)
+        if (specs[i].find("name") != std::string::npos)
+            named.push_back(replace_all(specs[i], "\"", "'"));
+    return named;
+}
+
+static void find_des_files(const std::string &folder,
+                           std::vector<std::string> &files)
+{
+    DIR *dir = opendir(folder.c_str());
+    if (!dir)
+        return;
+
+    while (struct dirent *entry = readdir(dir))
+    {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        const std::string path = folder + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            if (!in_list(name, ignore_des_subfolders,
+                         ARRAYSZ(ignore_des_subfolders)))
+            {
+                find_des_files(path, files);
+            }
+        }
+        else if (ends_with(name, ".des")
+                 && !in_list(name, ignore_des_files,
+                             ARRAYSZ(ignore_des_files)))
+        {
+            files.push_back(path);
+        }
+    }
+    closedir(dir);
+}
+
+des_scanner::des_scanner(const std::string &_cache_path)
+    : cache_path(_cache_path), cached_specs_hash(0), specs_hash(0),
+      scanned(0), parsed(0)
+{
+    load_cache();
+}
+
+void des_scanner::load_cache()
+{
+    std::string contents;
+    if (!read_file(cache_path, contents))
+        return;
+    // No line is blank, so blank segments are only the end of the file.
+    const std::vector<std::string> lines = split_string("\n", contents,
+                                                        false);
+
+    // Any damage and the whole cache is ignored.
+    unsigned long long hash;
+    if (lines.size() < 2 || lines[0] != DES_CACHE_HEADER
+        || sscanf(lines[1].c_str(), "specs %llx", &hash) != 1)
+    {
+        return;
+    }
+
+    file_cache loaded;
+    for (unsigned int i = 2; i < lines.size(); )
+    {
+        unsigned long long file_hash;
+        unsigned int count;
+        if (sscanf(lines[i].c_str(), "file %llx %u", &file_hash, &count) != 2
+            || count > lines.size() - i - 1)
+        {
+            return;
+        }
+        std::vector<std::string> &specs = loaded[file_hash];
+        specs.assign(lines.begin() + i + 1, lines.begin() + i + 1 + count);
+        i += count + 1;
+    }
+
+    cache.swap(loaded);
+    cached_specs_hash = hash;
+}
+
+/**
+ * Scan every .des file under des_folder, using up to jobs threads. Files
+ * whose contents are in the cache aren't parsed again.
+ *
+ * @return Whether there were any .des files to scan.
+ *
+**/
+bool des_scanner::scan(const std::string &des_folder, int jobs)
+{
+    std::vector<std::string> files;
+    find_des_files(des_folder, files);
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+        return false;
+
+    std::vector<uint64_t> hashes(files.size());
+    std::vector<std::vector<std::string> > specs(files.size());
+    std::vector<char> was_parsed(files.size(), 0);
+    std::vector<char> failed(files.size(), 0);
+    std::atomic<unsigned int> next(0);
+
+    // The cache is only read while the workers run.
+    auto work = [&]()
+    {
+        unsigned int i;
+        while ((i = next++) < files.size())
+        {
+            std::string contents;
+            if (!read_file(files[i], contents))
+            {
+                failed[i] = 1;
+                continue;
+            }
+
+            hashes[i] = fnv1a_hash(contents.data(), contents.size());
+            file_cache::const_iterator cached = cache.find(hashes[i]);
+            if (cached != cache.end())
+                specs[i] = cached->second;
+            else
+            {
+                specs[i] = des_monster_specs(contents);
+                was_parsed[i] = 1;
+            }
+        }
+    };
+
+    const int nthreads = std::max(1, std::min<int>(jobs, files.size()));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nthreads; ++i)
+        threads.push_back(std::thread(work));
+    work();
+    for (unsigned int i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    std::set<std::string> unique;
+    scanned_files.clear();
+    scanned = parsed = 0;
+    for (unsigned int i = 0; i < files.size(); ++i)
+    {
+        if (failed[i])
+        {
+            fprintf(stderr, "Can't read %s\n", files[i].c_str());
+            return false;
+        }
+        ++scanned;
+        parsed += was_parsed[i];
+        unique.insert(specs[i].begin(), specs[i].end());
+        scanned_files[hashes[i]].swap(specs[i]);
+    }
+
+    found_specs.assign(unique.begin(), unique.end());
+    specs_hash = FNV1A_OFFSET_BASIS;
+    for (unsigned int i = 0; i < found_specs.size(); ++i)
+    {
+        specs_hash = fnv1a_hash(found_specs[i].c_str(),
+                                found_specs[i].size() + 1, specs_hash);
+    }
+    return true;
+}
+
+/**
+ * Save the files of the last scan, and its result, as the cache for the
+ * next one. Call this only once the specs have been written out, so that
+ * changed() stays true until they have been.
+ *
+**/
+bool des_scanner::save_cache() const
+{
+    return write_file_atomically(cache_path, [this](FILE *out)
+    {
+        fprintf(out, "%s\nspecs %llx\n", DES_CACHE_HEADER,
+                (unsigned long long) specs_hash);
+        for (file_cache::const_iterator i = scanned_files.begin();
+             i != scanned_files.end(); ++i)
+        {
+            fprintf(out, "file %llx %u\n", (unsigned long long) i->first,
+                    (unsigned int) i->second.size());
+            for (unsigned int j = 0; j < i->second.size(); ++j)
+                fprintf(out, "%s\n", i->second[j].c_str());
+        }
+    });
+}
@@ -0,0 +1,55 @@
+/**
+ * @file des_scan.h
+ *
+ * @section DESCRIPTION
+ *
+ * Extract named monster specs from crawl's .des files, for the vault
+ * monster pack. Files are scanned in parallel, and the specs found in each
+ * file are cached by a hash of its contents, so that a rescan only parses
+ * the files that changed.
+ *
+**/
+
+#ifndef __DES_SCAN_H__
+#define __DES_SCAN_H__
+
+#include "AppHdr.h"
+
+#include <map>
+#include <stdint.h>
+
+class des_scanner
+{
+public:
+    explicit des_scanner(const std::string &cache_path);
+
+    bool scan(const std::string &des_folder, int jobs);
+    bool save_cache() const;
+
+    // Sorted and unique, as they go into the pack.
+    const std::vector<std::string> &specs() const { return found_specs; }
+    // Whether specs() differs from the result of the last saved scan.
+    bool changed() const { return specs_hash != cached_specs_hash; }
+
+    int files_scanned() const { return scanned; }
+    int files_parsed() const { return parsed; }
+
+private:
+    typedef std::map<uint64_t, std::vector<std::string> > file_cache;
+
+    std::string cache_path;
+    file_cache cache;
+    uint64_t cached_specs_hash;
+
+    file_cache scanned_files;
+    std::vector<std::string> found_specs;
+    uint64_t specs_hash;
+    int scanned;
+    int parsed;
+
+    void load_cache();
+};
+
+std::vector<std::string> des_monster_specs(const std::string &des_text);
+
+#endif
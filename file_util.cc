@@ -0,0 +1,107 @@
+/**
+ * @file file_util.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Shared file helpers (see file_util.h).
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "file_util.h"
+#include "stringutil.h"
+
+#include <unistd.h>
+
+uint64_t fnv1a_hash(const void *data, size_t size, uint64_t hash)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Read a whole file into contents.
+ *
+ * @return Whether the file could be opened and read.
+ *
+**/
+bool read_file(const std::string &path, std::string &contents)
+{
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in)
+        return false;
+
+    contents.clear();
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof buf, in)) > 0)
+        contents.append(buf, n);
+    const bool ok = !ferror(in);
+    fclose(in);
+    return ok;
+}
+
+/**
+ * The name to build a new version of path under, unique to this process
+ * so that concurrent writers don't trample each other.
+ *
+**/
+std::string temp_file_path(const std::string &path)
+{
+    return make_stringf("%s.tmp.%d", path.c_str(), (int) getpid());
+}
+
+/**
+ * Rename a finished temporary file over path, so that readers see either
+ * the old file or the new one, never a partial one. On failure the error
+ * is reported and the temporary file removed.
+ *
+**/
+bool replace_with_temp_file(const std::string &tmp_path,
+                            const std::string &path)
+{
+    if (rename(tmp_path.c_str(), path.c_str()) < 0)
+    {
+        perror(path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * (Re)write a file atomically: write it under temp_file_path() and rename
+ * it into place once it has been written and closed without error.
+ *
+ * @param path  The file to write.
+ * @param write Writes the contents.
+ * @return Whether the file was written.
+ *
+**/
+bool write_file_atomically(const std::string &path, file_writer write)
+{
+    const std::string tmp_path = temp_file_path(path);
+    FILE *out = fopen(tmp_path.c_str(), "wb");
+    if (!out)
+    {
+        perror(tmp_path.c_str());
+        return false;
+    }
+
+    write(out);
+
+    const bool ok = !ferror(out);
+    if (fclose(out) != 0 || !ok)
+    {
+        perror(path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return replace_with_temp_file(tmp_path, path);
+}
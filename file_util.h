@@ -0,0 +1,37 @@
+/**
+ * @file file_util.h
+ *
+ * @section DESCRIPTION
+ *
+ * Helpers shared by the code that reads and writes monster-trunk's data
+ * files (vault pack, stat table, database, snapshots, caches): whole-file
+ * reads, atomic replacement and content hashing.
+ *
+**/
+
+#ifndef __FILE_UTIL_H__
+#define __FILE_UTIL_H__
+
+#include "AppHdr.h"
+
+#include <functional>
+#include <stdint.h>
+
+#define FNV1A_OFFSET_BASIS 14695981039346656037ULL
+
+// 64-bit FNV-1a of size bytes, continuing from hash.
+uint64_t fnv1a_hash(const void *data, size_t size,
+                    uint64_t hash = FNV1A_OFFSET_BASIS);
+
+bool read_file(const std::string &path, std::string &contents);
+
+std::string temp_file_path(const std::string &path);
+bool replace_with_temp_file(const std::string &tmp_path,
+                            const std::string &path);
+
+// Writes the contents of a file; errors are picked up with ferror().
+typedef std::function<void (FILE *out)> file_writer;
+
+bool write_file_atomically(const std::string &path, file_writer write);
+
+#endif
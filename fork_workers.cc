@@ -0,0 +1,156 @@
+/**
+ * @file fork_workers.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Run work in parallel in forked child processes. Crawl keeps its state in
+ * globals (menv, env, you), so threads are out of the question, but each
+ * forked child gets its own copy of a fully initialised crawl for free.
+ * Children send their results back to the parent over a pipe.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "fork_workers.h"
+
+#include <cerrno>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool write_all(int fd, const std::string &data)
+{
+    const char *buf = data.data();
+    std::string::size_type left = data.size();
+    while (left > 0)
+    {
+        const ssize_t written = write(fd, buf, left);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += written;
+        left -= written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, std::string &data)
+{
+    char buf[8192];
+    while (true)
+    {
+        const ssize_t nread = read(fd, buf, sizeof buf);
+        if (nread == 0)
+            return true;
+        if (nread < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data.append(buf, nread);
+    }
+}
+
+/**
+ * Fork nworkers children, run work in each and collect what they return.
+ *
+ * Each child inherits whatever is left of the parent's alarm, so a stuck
+ * worker is killed no later than the parent would be.
+ *
+ * @param nworkers How many children to fork.
+ * @param work     The work to do in each child.
+ * @param results  Set to the result of each worker, in worker order.
+ * @return Whether every worker ran and succeeded.
+**/
+bool run_forked_workers(int nworkers, worker_function work,
+                        std::vector<std::string> &results)
+{
+    results.assign(nworkers, std::string());
+
+    // Don't let children flush a copy of anything the parent buffered.
+    fflush(stdout);
+    fflush(stderr);
+
+    const unsigned int alarm_left = alarm(0);
+    alarm(alarm_left);
+
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    bool ok = true;
+
+    for (int i = 0; i < nworkers; ++i)
+    {
+        int pipefd[2];
+        if (pipe(pipefd) < 0)
+        {
+            ok = false;
+            break;
+        }
+
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(pipefd[0]);
+            close(pipefd[1]);
+            ok = false;
+            break;
+        }
+
+        if (pid == 0)
+        {
+            close(pipefd[0]);
+            for (unsigned int j = 0; j < fds.size(); ++j)
+                close(fds[j]);
+            alarm(alarm_left);
+
+            std::string result;
+            const bool success = work(i, result);
+            const bool sent = write_all(pipefd[1], result);
+            close(pipefd[1]);
+            _exit(success && sent ? 0 : 1);
+        }
+
+        close(pipefd[1]);
+        pids.push_back(pid);
+        fds.push_back(pipefd[0]);
+    }
+
+    // Children block once their pipe is full, so read each to the end
+    // before reaping it.
+    for (unsigned int i = 0; i < fds.size(); ++i)
+    {
+        if (!read_all(fds[i], results[i]))
+            ok = false;
+        close(fds[i]);
+    }
+
+    for (unsigned int i = 0; i < pids.size(); ++i)
+    {
+        int status;
+        while (waitpid(pids[i], &status, 0) < 0)
+        {
+            if (errno != EINTR)
+            {
+                status = -1;
+                break;
+            }
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok = false;
+    }
+
+    return ok;
+}
+
+/**
+ * How many of total items of work fall to the given worker, when the work
+ * is split as evenly as possible between nworkers.
+**/
+int worker_share(int total, int worker, int nworkers)
+{
+    return total / nworkers + (worker < total % nworkers ? 1 : 0);
+}
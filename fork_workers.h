@@ -0,0 +1,24 @@
+/**
+ * fork_workers.h
+**/
+
+#ifndef __FORK_WORKERS_H__
+#define __FORK_WORKERS_H__
+
+#include "AppHdr.h"
+
+#include <functional>
+
+/**
+ * Work done in a forked child. worker is in [0, nworkers); anything appended
+ * to result is sent back to the parent. Returning false marks the worker as
+ * failed.
+**/
+typedef std::function<bool (int worker, std::string &result)> worker_function;
+
+bool run_forked_workers(int nworkers, worker_function work,
+                        std::vector<std::string> &results);
+
+int worker_share(int total, int worker, int nworkers);
+
+#endif
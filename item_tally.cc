@@ -0,0 +1,99 @@
+/**
+ * @file item_tally.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Item counts over sampled monsters (see item_tally.h).
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "item_tally.h"
+#include "stringutil.h"
+
+bool item_tally_key::operator < (const item_tally_key &other) const
+{
+    if (slot != other.slot)
+        return slot < other.slot;
+    if (base_type != other.base_type)
+        return base_type < other.base_type;
+    if (sub_type != other.sub_type)
+        return sub_type < other.sub_type;
+    if (ego != other.ego)
+        return ego < other.ego;
+    if (unrand != other.unrand)
+        return unrand < other.unrand;
+    return randart < other.randart;
+}
+
+item_tally::item_tally() : trials(0)
+{
+}
+
+void item_tally::add(const item_tally_key &key, int plus)
+{
+    item_tally_count &count = items[key];
+    ++count.count;
+    count.plus.add(plus);
+}
+
+void item_tally::merge(const item_tally &other)
+{
+    trials += other.trials;
+    for (std::map<item_tally_key, item_tally_count>::const_iterator i =
+             other.items.begin(); i != other.items.end(); ++i)
+    {
+        item_tally_count &count = items[i->first];
+        count.count += i->second.count;
+        count.plus.merge(i->second.plus);
+    }
+}
+
+// One "trials <n>" line, then a line per kind of item: its key, count and
+// enchantment sketch.
+std::string item_tally::serialise() const
+{
+    std::string out = make_stringf("trials %ld\n", trials);
+    for (std::map<item_tally_key, item_tally_count>::const_iterator i =
+             items.begin(); i != items.end(); ++i)
+    {
+        const item_tally_key &key = i->first;
+        out += make_stringf("item %d %d %d %d %d %d %ld|", key.slot,
+                            key.base_type, key.sub_type, key.ego, key.unrand,
+                            key.randart, i->second.count)
+               + i->second.plus.serialise() + "\n";
+    }
+    return out;
+}
+
+// Read one line written by serialise(), adding it to the tally.
+bool item_tally::deserialise_line(const std::string &line)
+{
+    long n;
+    if (sscanf(line.c_str(), "trials %ld", &n) == 1)
+    {
+        trials += n;
+        return true;
+    }
+
+    const std::string::size_type bar = line.find('|');
+    item_tally_key key;
+    int randart;
+    item_tally_count count;
+    if (bar == std::string::npos
+        || sscanf(line.c_str(), "item %d %d %d %d %d %d %ld|", &key.slot,
+                  &key.base_type, &key.sub_type, &key.ego, &key.unrand,
+                  &randart, &count.count) != 7
+        || !count.plus.deserialise(line.substr(bar + 1))
+        || count.plus.count() != count.count)
+    {
+        return false;
+    }
+    key.randart = randart;
+
+    item_tally_count &total = items[key];
+    total.count += count.count;
+    total.plus.merge(count.plus);
+    return true;
+}
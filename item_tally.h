@@ -0,0 +1,77 @@
+/**
+ * @file item_tally.h
+ *
+ * @section DESCRIPTION
+ *
+ * Counts of the items sampled monsters carry, by inventory slot and kind
+ * of item, for --items reports. Items are counted by their numeric fields
+ * (slot, base type, sub type, ego, artefact) rather than by name, so adding
+ * a trial is cheap; names are only worked out when the report is rendered.
+ * Tallies merge, so each forked worker can keep its own.
+ *
+**/
+
+#ifndef __ITEM_TALLY_H__
+#define __ITEM_TALLY_H__
+
+#include "AppHdr.h"
+
+#include "value_sketch.h"
+
+#include <map>
+
+// Which kind of item was in a slot.
+struct item_tally_key
+{
+    int slot;
+    int base_type;
+    int sub_type;
+    // The brand or ego; 0 for none, and for artefacts.
+    int ego;
+    // The unrandart index, or 0.
+    int unrand;
+    bool randart;
+
+    item_tally_key()
+        : slot(0), base_type(0), sub_type(0), ego(0), unrand(0),
+          randart(false)
+    {
+    }
+
+    bool operator < (const item_tally_key &other) const;
+};
+
+struct item_tally_count
+{
+    long count;
+    // The enchantment (or charges) of the items counted.
+    value_sketch plus;
+
+    item_tally_count() : count(0) { }
+};
+
+class item_tally
+{
+public:
+    item_tally();
+
+    // Count one more sampled monster; its items are then add()ed.
+    void add_trial() { ++trials; }
+    void add(const item_tally_key &key, int plus);
+    void merge(const item_tally &other);
+
+    long trial_count() const { return trials; }
+    const std::map<item_tally_key, item_tally_count> &counts() const
+    {
+        return items;
+    }
+
+    std::string serialise() const;
+    bool deserialise_line(const std::string &line);
+
+private:
+    long trials;
+    std::map<item_tally_key, item_tally_count> items;
+};
+
+#endif
@@ -37,6 +37,7 @@
 #include "message.h"
 #include "mon-abil.h"
 #include "mon-book.h"
+#include "mon-spell.h"
 #include "mon-cast.h"
 #include "mon-util.h"
 #include "version.h"
@@ -55,9 +56,30 @@
 #include "stepdown.h"
 #include "stringutil.h"
 #include "artefact.h"
+#include "deadline.h"
+#include "des_scan.h"
+#include "file_util.h"
+#include "fork_workers.h"
+#include "item_tally.h"
+#include "monster_db.h"
+#include "monster_report.h"
+#include "name_index.h"
+#include "query_server.h"
+#include "report_snapshot.h"
+#include "result_cache.h"
+#include "sandbox.h"
+#include "stat_table.h"
+#include "trace.h"
+#include "value_sketch.h"
 #include "vault_monsters.h"
-#include <sstream>
+#include "vault_pack.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <climits>
+#include <cmath>
 #include <set>
+#include <thread>
 #include <unistd.h>
 
 extern const spell_type serpent_of_hell_breaths[4][3];
@@ -85,98 +107,25 @@ bool is_element_colour(int col)
 }
 
 
-static std::string colour_codes[] = {
-    "",
-    "02",
-    "03",
-    "10",
-    "05",
-    "06",
-    "07",
-    "15",
-    "14",
-    "12",
-    "09",
-    "11",
-    "04",
-    "13",
-    "08",
-    "00"
-};
-
-static int bgr[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
-
-#ifdef CONTROL
-#undef CONTROL
-#endif
-#define CONTROL(x) char(x - 'A' + 1)
-
-static std::string colour(int colour, std::string text, bool bg = false)
-{
-    if (is_element_colour(colour))
-        colour = element_colour(colour, true);
-
-    if (isatty(1))
-    {
-        if (!colour)
-            return text;
-        return make_stringf("\e[0;%d%d%sm%s\e[0m", bg ? 4 : 3, bgr[colour & 7],
-                            (!bg && (colour & 8)) ? ";1" : "", text.c_str());
-    }
-
-    const std::string code(colour_codes[colour]);
-
-    if (code.empty())
-        return text;
-
-    return (std::string() + CONTROL('C') + code + (bg ? ",01" : "")
-            + text + CONTROL('O'));
-}
-
 std::string uppercase_first(std::string s);
 
-template <class T> inline std::string to_string (const T& t);
-
-static void record_resvul(int color, const char *name, const char *caption,
-                          std::string &str, int rval)
-{
-  if (str.empty())
-    str = " | " + std::string(caption) + ": ";
-  else
-    str += ", ";
-
-  if (color && (rval == 3 || rval == 1 && color == BROWN
-                || std::string(caption) == "Vul")
-            && (int) color <= 7)
-    color += 8;
-
-  std::string token(name);
-  if (rval > 1 && rval <= 3) {
-    while (rval-- > 0)
-      token += "+";
-  }
-
-  str += colour(color, token);
-}
-
 static void record_resist(int colour, std::string name,
-                          std::string &res, std::string &vul,
-                          int rval)
+                          std::vector<report_resist> &resists, int rval)
 {
-  if (rval > 0)
-    record_resvul(colour, name.c_str(), "Res", res, rval);
-  else if (rval < 0)
-    record_resvul(colour, name.c_str(), "Vul", vul, -rval);
+  if (!rval)
+    return;
+
+  report_resist resist;
+  resist.name = name;
+  resist.colour = colour;
+  resist.level = rval;
+  resists.push_back(resist);
 }
 
-static void monster_action_cost(std::string &qual, int cost, const char *desc) {
-  char buf[80];
-  if (cost != 10) {
-    snprintf(buf, sizeof buf, "%s: %d%%", desc, cost * 10);
-    if (!qual.empty())
-      qual += "; ";
-    qual += buf;
-  }
+static void monster_action_cost(monster_report &rep, int cost,
+                                const char *desc) {
+  if (cost != 10)
+    rep.energy.push_back(std::make_pair(std::string(desc), cost * 10));
 }
 
 static std::string monster_int(const monster &mon)
@@ -222,75 +171,58 @@ static std::string monster_size(const monster &mon)
   }
 }
 
-static std::string monster_speed(const monster &mon,
-                                 const monsterentry *me,
-                                 int speed_min,
-                                 int speed_max)
+static void monster_speed(const monster &mon, int speed_min, int speed_max,
+                          monster_report &rep)
 {
-  std::string speed;
-
-  char buf[50];
-  if (speed_max != speed_min)
-    snprintf(buf, sizeof buf, "%i-%i", speed_min, speed_max);
-  else if (speed_max == 0)
-    snprintf(buf, sizeof buf, "%s", colour(BROWN, "0").c_str());
-  else
-    snprintf(buf, sizeof buf, "%i", speed_max);
-
-  speed += buf;
+  rep.speed_min = speed_min;
+  rep.speed_max = speed_max;
 
   const mon_energy_usage &cost = mons_energy(&mon);
-  std::string qualifiers;
 
   bool skip_action = false;
   if (cost.attack != 10
       && cost.attack == cost.missile && cost.attack == cost.spell
       && cost.attack == cost.special && cost.attack == cost.item)
   {
-    monster_action_cost(qualifiers, cost.attack, "act");
+    monster_action_cost(rep, cost.attack, "act");
     skip_action = true;
   }
 
-  monster_action_cost(qualifiers, cost.move, "move");
+  monster_action_cost(rep, cost.move, "move");
   if (cost.swim != cost.move)
-    monster_action_cost(qualifiers, cost.swim, "swim");
+    monster_action_cost(rep, cost.swim, "swim");
   if (!skip_action)
   {
-    monster_action_cost(qualifiers, cost.attack, "atk");
-    monster_action_cost(qualifiers, cost.missile, "msl");
-    monster_action_cost(qualifiers, cost.spell, "spell");
-    monster_action_cost(qualifiers, cost.special, "special");
-    monster_action_cost(qualifiers, cost.item, "item");
-  }
-  if (speed_max > 0 && mons_class_flag(mon.type, M_STATIONARY))
-  {
-    if (!qualifiers.empty())
-      qualifiers += "; ";
-    qualifiers += colour(BROWN, "stationary");
+    monster_action_cost(rep, cost.attack, "atk");
+    monster_action_cost(rep, cost.missile, "msl");
+    monster_action_cost(rep, cost.spell, "spell");
+    monster_action_cost(rep, cost.special, "special");
+    monster_action_cost(rep, cost.item, "item");
   }
-
-  if (!qualifiers.empty())
-    speed += " (" + qualifiers + ")";
-
-  return speed;
+  rep.stationary = speed_max > 0 && mons_class_flag(mon.type, M_STATIONARY);
 }
 
-static void mons_flag(std::string &flag, const std::string &newflag) {
-  if (flag.empty())
-    flag = " | ";
-  else
-    flag += ", ";
-  flag += newflag;
+static void mons_flag(std::vector<report_token> &flags,
+                      const report_token &newflag) {
+  flags.push_back(newflag);
 }
 
-static void mons_check_flag(bool set, std::string &flag,
-                            const std::string &newflag)
+static void mons_check_flag(bool set, std::vector<report_token> &flags,
+                            const report_token &newflag)
 {
   if (set)
-    mons_flag(flag, newflag);
+    mons_flag(flags, newflag);
 }
 
+// Safe to call more than once; only the first call does anything.
 static void initialize_crawl() {
+  static bool initialised = false;
+  if (initialised)
+    return;
+  initialised = true;
+
+  TRACE_SPAN(span, "initialize_crawl");
+
   init_monsters();
   init_properties();
   init_item_name_cache();
@@ -312,6 +244,8 @@ static void initialize_crawl() {
   you.hp = you.hp_max = PLAYER_MAXHP;
   you.magic_points = you.max_magic_points = PLAYER_MAXMP;
   you.species = SP_HUMAN;
+
+  sandbox_checkpoint();
 }
 
 static std::string dice_def_string(dice_def dice) {
@@ -418,115 +352,238 @@ static std::string shorten_spell_name(std::string name) {
   return (name);
 }
 
-std::string spell_flag_string(const mon_spell_slot &slot)
+static std::vector<report_token> spell_flags(mon_spell_slot_flags slot_flags)
 {
-  std::string flags;
+  std::vector<report_token> flags;
+
+  if (!(slot_flags & MON_SPELL_ANTIMAGIC_MASK))
+    flags.push_back(report_token(LIGHTCYAN, "!AM"));
+  if (!(slot_flags & MON_SPELL_SILENCE_MASK))
+    flags.push_back(report_token(MAGENTA, "!sil"));
+  if (slot_flags & MON_SPELL_BREATH)
+    flags.push_back(report_token(YELLOW, "breath"));
+  if (slot_flags & MON_SPELL_EMERGENCY)
+    flags.push_back(report_token(LIGHTRED, "emergency"));
+  return flags;
+}
+
+// The short name of a spell, worked out once per spell.
+static const std::string &short_spell_name(spell_type sp)
+{
+  static std::map<spell_type, std::string> names;
+  std::map<spell_type, std::string>::const_iterator found = names.find(sp);
+  if (found != names.end())
+    return found->second;
+  return names[sp] = shorten_spell_name(spell_title(sp));
+}
+
+// Damage strings depend only on the spell, the kind of monster and its
+// (spell) HD, so they're worked out once per query for each combination.
+struct spell_damage_key
+{
+  spell_type spell;
+  monster_type type;
+  int spell_hd;
+  int hd;
 
-  if (!(slot.flags & MON_SPELL_ANTIMAGIC_MASK))
-    flags += colour(LIGHTCYAN, "!AM");
-  if (!(slot.flags & MON_SPELL_SILENCE_MASK))
+  bool operator < (const spell_damage_key &other) const
   {
-    if (!flags.empty())
-      flags += ", ";
-    flags += colour(MAGENTA, "!sil");
+    if (spell != other.spell)
+      return spell < other.spell;
+    if (type != other.type)
+      return type < other.type;
+    if (spell_hd != other.spell_hd)
+      return spell_hd < other.spell_hd;
+    return hd < other.hd;
   }
-  if (slot.flags & MON_SPELL_BREATH)
+
+  bool operator == (const spell_damage_key &other) const
   {
-    if (!flags.empty())
-      flags += ", ";
-    flags += colour(YELLOW, "breath");
+    return spell == other.spell && type == other.type
+           && spell_hd == other.spell_hd && hd == other.hd;
+  }
+};
+
+static spell_damage_key make_spell_damage_key(monster *mp, spell_type sp)
+{
+  spell_damage_key key;
+  key.spell = sp;
+  key.type = mp->type;
+  key.spell_hd = mp->spell_hd(sp);
+  key.hd = mp->get_experience_level();
+  return key;
+}
+
+typedef std::map<spell_damage_key, std::vector<std::string> >
+  spell_damage_cache;
+
+// Cleared at the start of every query.
+static spell_damage_cache damage_cache;
+
+/**
+ * The distinct damage strings seen in 100 samples of the damage of the
+ * given monster's spell, in order of first appearance. Some beams are
+ * random, hence the sampling; the result is cached, so each combination
+ * of spell, monster type and HD is only sampled once per query.
+ */
+static const std::vector<std::string> &spell_damages(monster *mp,
+                                                     spell_type sp)
+{
+  const spell_damage_key key = make_spell_damage_key(mp, sp);
+
+  spell_damage_cache::iterator cached = damage_cache.find(key);
+  if (cached != damage_cache.end())
+    return cached->second;
+
+  TRACE_SPAN(span, "spell_damage");
+  std::vector<std::string> &damages = damage_cache[key];
+  std::set<std::string> added_damages;
+  for (int i = 0; i < 100; i++) {
+    const std::string damage = mons_human_readable_spell_damage_string(mp, sp);
+    if (!damage.empty() && added_damages.insert(damage).second)
+      damages.push_back(damage);
   }
-  if (slot.flags & MON_SPELL_EMERGENCY)
+  return damages;
+}
+
+// A spell in a spell set, with the flags of its slot.
+struct spell_set_slot
+{
+  spell_type spell;
+  mon_spell_slot_flags flags;
+
+  bool operator < (const spell_set_slot &other) const
   {
-    if (!flags.empty())
-      flags += ", ";
-    flags += colour(LIGHTRED, "emergency");
+    if (spell != other.spell)
+      return spell < other.spell;
+    return flags < other.flags;
   }
+};
 
-  if (!flags.empty())
-    flags = " [" + flags + "]";
-  return flags;
+// A monster's spells in one trial, in slot order. Sets are rendered only
+// once sampling is done (see construct_spells()).
+typedef std::vector<spell_set_slot> spell_set;
+
+// The damages seen for one spell over the trials.
+struct spell_damage_seen
+{
+  // The combinations of monster and HD already looked up, so that a trial
+  // like an earlier one doesn't touch any strings.
+  std::vector<spell_damage_key> keys;
+  // Distinct damage strings, in order of first appearance.
+  std::vector<std::string> damages;
+};
+typedef std::map<spell_type, spell_damage_seen> spell_damage_map;
+
+// Returns whether the damage is new.
+static bool add_spell_damage(spell_damage_seen &seen,
+                             const std::string &damage)
+{
+  if (std::find(seen.damages.begin(), seen.damages.end(), damage)
+      != seen.damages.end())
+  {
+    return false;
+  }
+  seen.damages.push_back(damage);
+  return true;
 }
 
-// ::first is spell name, ::second is possible damages
-typedef std::multimap<std::string, std::string> spell_damage_map;
-static spell_damage_map record_spell_set(monster *mp, std::string& ret)
+/**
+ * Record the spells of a sampled monster as a spell set, adding the
+ * damages of its spells to damages.
+ *
+ * Returns whether any damage was new.
+ */
+static bool record_spell_set(monster *mp, spell_set &set,
+                             spell_damage_map &damages)
 {
-  spell_damage_map damages;
+  bool new_damage = false;
+  set.clear();
   for (std::size_t i = 0; i < mp->spells.size(); ++i) {
-    spell_type sp = mp->spells[i].spell;
-    if (!ret.empty())
-      ret += ", ";
-    if (sp == SPELL_SERPENT_OF_HELL_BREATH) {
-      const int idx =
-            mp->type == MONS_SERPENT_OF_HELL          ? 0
-          : mp->type == MONS_SERPENT_OF_HELL_COCYTUS  ? 1
-          : mp->type == MONS_SERPENT_OF_HELL_DIS      ? 2
-          : mp->type == MONS_SERPENT_OF_HELL_TARTARUS ? 3
-          :                                               -1;
-      ASSERT(idx >= 0 && idx <= 3);
-      ASSERT(mp->number == ARRAYSZ(serpent_of_hell_breaths[idx]));
-
-      ret += "{";
-      for (unsigned int k = 0; k < mp->number; ++k) {
-        const spell_type breath = serpent_of_hell_breaths[idx][k];
-        const std::string rawname = spell_title(breath);
-        ret += k == 0 ? "" : ", ";
-        ret += make_stringf("head %d: ", k + 1) + shorten_spell_name(rawname) + " (";
-        ret += mons_human_readable_spell_damage_string(mp, breath) + ")";
-      }
-      ret += "}";
+    const spell_type sp = mp->spells[i].spell;
+    spell_set_slot slot;
+    slot.spell = sp;
+    slot.flags = mp->spells[i].flags;
+    set.push_back(slot);
+
+    // Breath damages are shown per head when rendering.
+    if (sp == SPELL_SERPENT_OF_HELL_BREATH)
+      continue;
 
-      ret += spell_flag_string(mp->spells[i]);
-    }
-    else {
-      std::string spell_name = spell_title(sp);
-      spell_name = shorten_spell_name(spell_name);
-      ret += spell_name;
-      ret += spell_flag_string(mp->spells[i]);
-
-      for (int i = 0; i < 100; i++) {
-        std::string damage = mons_human_readable_spell_damage_string(mp, sp);
-        std::set<std::string> added_damages;
-        if (!damage.empty() && !added_damages.count(damage))
-        {
-          damages.insert(std::pair<std::string, std::string>(spell_name, damage));
-          added_damages.insert(damage);
-        }
-      }
+    spell_damage_seen &seen = damages[sp];
+    const spell_damage_key key = make_spell_damage_key(mp, sp);
+    if (std::find(seen.keys.begin(), seen.keys.end(), key)
+        != seen.keys.end())
+    {
+      continue;
     }
+    seen.keys.push_back(key);
+
+    const std::vector<std::string> &spell_damage = spell_damages(mp, sp);
+    for (std::size_t j = 0; j < spell_damage.size(); ++j)
+      new_damage |= add_spell_damage(seen, spell_damage[j]);
   }
-  return damages;
+  return new_damage;
 }
 
-static std::string construct_spells(std::set<std::string> spells,
-                                    spell_damage_map damages)
+// The heads of a serpent of Hell's breath, each with its damage.
+static std::vector<std::pair<std::string, std::string> >
+serpent_breath_heads(monster *mp)
 {
-  std::string ret;
-  for (std::set<std::string>::const_iterator i = spells.begin();
-       i != spells.end(); ++i)
-  {
-    if (i != spells.begin())
-      ret += " / ";
-    ret += *i;
-  }
-  std::map<std::string, std::string> merged_spell_dam;
-  for (spell_damage_map::const_iterator i = damages.begin(); i != damages.end(); ++i)
-  {
-    std::string dam = merged_spell_dam[i->first];
-    if (!dam.empty())
-      dam += " / ";
-    dam += i->second;
-    merged_spell_dam[i->first] = dam;
+  const int idx =
+        mp->type == MONS_SERPENT_OF_HELL          ? 0
+      : mp->type == MONS_SERPENT_OF_HELL_COCYTUS  ? 1
+      : mp->type == MONS_SERPENT_OF_HELL_DIS      ? 2
+      : mp->type == MONS_SERPENT_OF_HELL_TARTARUS ? 3
+      :                                               -1;
+  ASSERT(idx >= 0 && idx <= 3);
+  ASSERT(mp->number == ARRAYSZ(serpent_of_hell_breaths[idx]));
+
+  std::vector<std::pair<std::string, std::string> > heads;
+  for (unsigned int k = 0; k < mp->number; ++k) {
+    const spell_type breath = serpent_of_hell_breaths[idx][k];
+    const std::vector<std::string> &breath_damages =
+      spell_damages(mp, breath);
+    heads.push_back(std::make_pair(short_spell_name(breath),
+                                   breath_damages.empty() ? ""
+                                                          : breath_damages[0]));
   }
+  return heads;
+}
 
-  for (std::map<std::string, std::string>::const_iterator i = merged_spell_dam.begin();
-       i != merged_spell_dam.end(); ++i)
+/**
+ * The spell sets seen, each spell with every damage seen for it, for the
+ * report. mp is the monster being described, for serpent of Hell breaths.
+ */
+static std::vector<report_spell_set>
+construct_spells(monster *mp, const std::set<spell_set> &spells,
+                 const spell_damage_map &damages)
+{
+  std::vector<report_spell_set> sets;
+  for (std::set<spell_set>::const_iterator i = spells.begin();
+       i != spells.end(); ++i)
   {
-    ret = replace_all(ret, i->first, make_stringf("%s (%s)", i->first.c_str(), i->second.c_str()));
-  }
+    report_spell_set set;
+    for (std::size_t j = 0; j < i->size(); ++j)
+    {
+      const spell_set_slot &slot = (*i)[j];
+      report_spell spell;
+      spell.name = short_spell_name(slot.spell);
+      spell.flags = spell_flags(slot.flags);
 
-  return ret;
+      if (slot.spell == SPELL_SERPENT_OF_HELL_BREATH)
+        spell.heads = serpent_breath_heads(mp);
+      else
+      {
+        spell_damage_map::const_iterator seen = damages.find(slot.spell);
+        if (seen != damages.end())
+          spell.damages = seen->second.damages;
+      }
+      set.push_back(spell);
+    }
+    sets.push_back(set);
+  }
+  return sets;
 }
 
 static inline void set_min_max(int num, int &min, int &max) {
@@ -536,13 +593,15 @@ static inline void set_min_max(int num, int &min, int &max) {
     max = num;
 }
 
-static std::string monster_symbol(const monster &mon) {
-  std::string symbol;
+static report_token monster_symbol(const monster &mon) {
+  report_token symbol;
   const monsterentry *me = mon.find_monsterentry();
   if (me) {
     monster_info mi(&mon, MILEV_NAME);
-    symbol += me->basechar;
-    symbol = colour(mi.colour(), symbol);
+    symbol.text += me->basechar;
+    symbol.colour = mi.colour();
+    if (is_element_colour(symbol.colour))
+      symbol.colour = element_colour(symbol.colour, true);
   }
   return (symbol);
 }
@@ -609,166 +668,440 @@ static void rebind_mspec(std::string *requested_name,
   }
 }
 
-static std::string canned_reports[][2] = {
-  { "cang",
-    ("cang (" + colour(LIGHTRED, "Ω")
-     + (") | Spd: c | HD: i | HP: 666 | AC/EV: e/π | Dam: 999"
-         " | Res: sanity | XP: ∞ | Int: god | Sz: !!!")) },
-};
-
-int main(int argc, char *argv[])
+// Options that apply to every query run by this process.
+struct query_options
 {
-  alarm(5);
-  crawl_state.test = true;
-  if (argc < 2)
+  // Number of processes to fork for sampling; 1 samples in-process.
+  int jobs;
+
+  // Sampling stops once at least min_trials monsters have been measured
+  // and the stats have converged (see trials_converged()), or after
+  // max_trials monsters regardless.
+  int min_trials;
+  int max_trials;
+  // Converged means nothing new (HP or speed extreme, spell set or spell
+  // damage) was seen in the last novelty_trials trials...
+  int novelty_trials;
+  // ... and the standard error of the mean AC, EV and XP is within this
+  // fraction of the mean.
+  double confidence;
+  // Milliseconds a query may take (0 for no limit). Sampling stops early
+  // to report on the trials done so far rather than overrun.
+  int deadline_ms;
+
+  // Append the number of trials used to the report.
+  bool show_trials;
+  // Append the mean, standard deviation and quantiles of HP, AC, EV and
+  // XP over the trials to the report.
+  bool distributions;
+  // Append how often each kind of item is carried to the report.
+  bool items;
+
+  // How reports are written: the coloured one-liner, JSON or CSV.
+  report_format format;
+  // How text reports are coloured.
+  colour_backend colours;
+
+  // A monster database (see export_db()) to answer queries from before
+  // computing them live.
+  std::string db_path;
+
+  // A result cache (see result_cache.h) to answer queries from, and to
+  // store computed reports in.
+  std::string cache_path;
+
+  query_options()
+    : jobs(1), min_trials(20), max_trials(200), novelty_trials(20),
+      confidence(0.01), deadline_ms(0), show_trials(false),
+      distributions(false),
+      items(false), format(REPORT_TEXT),
+      colours(COLOUR_AUTO)
   {
-    printf("Usage: @? <monster name>\n");
-    return 0;
   }
+};
+
+static query_options qopts;
+
+// The settings that decide how many trials are sampled, for telling
+// whether stored reports (databases, snapshots) were computed the same way.
+static std::string trial_settings()
+{
+  return make_stringf("%d %d %d %g", qopts.min_trials, qopts.max_trials,
+                      qopts.novelty_trials, qopts.confidence);
+}
+
+// With a deadline, CSV reports say whether they are partial and on how
+// many trials.
+static bool show_partial()
+{
+  return qopts.deadline_ms > 0;
+}
+
+// An error report for a failed query, in the query's output format.
+static std::string query_error(const std::string &message)
+{
+  return emit_report_error(message, qopts.format, qopts.show_trials,
+                           show_partial());
+}
+
+// Statistics gathered over a number of sampled monsters. Stats gathered in
+// different processes can be merged.
+struct trial_stats
+{
+  int trials;
+  value_sketch exper, mac, mev, hp;
+  int speed_min, speed_max;
+  std::set<spell_set> spells;
+  spell_damage_map damages;
+  // Only kept for --items.
+  item_tally items;
+  // Sampling was cut short by the deadline.
+  bool partial;
 
-  if (!strcmp(argv[1], "-version") || !strcmp(argv[1], "--version"))
+  trial_stats() : trials(0), speed_min(0), speed_max(0), partial(false)
   {
-    printf("Monster stats Crawl version: %s\n", Version::Long);
-    return 0;
   }
-  else if (!strcmp(argv[1], "-name") || !strcmp(argv[1], "--name"))
+};
+
+static void merge_spell_damages(spell_damage_map &damages,
+                                const spell_damage_map &new_damages)
+{
+  for (spell_damage_map::const_iterator i = new_damages.begin();
+       i != new_damages.end(); ++i)
   {
-    seed_rng();
-    printf("%s\n", make_name().c_str());
-    return 0;
+    spell_damage_seen &seen = damages[i->first];
+    for (std::size_t j = 0; j < i->second.damages.size(); ++j)
+      add_spell_damage(seen, i->second.damages[j]);
   }
+}
 
-  initialize_crawl();
-
-  mons_list mons;
-  std::string target = argv[1];
+static void merge_trial_stats(trial_stats &stats, const trial_stats &other)
+{
+  if (!other.trials)
+    return;
+
+  stats.trials += other.trials;
+  stats.partial |= other.partial;
+  stats.exper.merge(other.exper);
+  stats.mac.merge(other.mac);
+  stats.mev.merge(other.mev);
+  stats.hp.merge(other.hp);
+  set_min_max(other.speed_min, stats.speed_min, stats.speed_max);
+  set_min_max(other.speed_max, stats.speed_min, stats.speed_max);
+  stats.spells.insert(other.spells.begin(), other.spells.end());
+  merge_spell_damages(stats.damages, other.damages);
+  stats.items.merge(other.items);
+}
 
-  if (argc > 2)
-    for (int x = 2; x < argc; x++)
+// One line of totals, one line per value sketch ("X", "A", "E" and "H"
+// followed by the sketch), then one line per spell set ("S <spell>:<flags>,
+// ...") and per spell damage ("D <spell>\t<damage>"), then the item tally
+// ("I " followed by each of its lines). None of these strings contain
+// newlines.
+static std::string serialise_trial_stats(const trial_stats &stats)
+{
+  std::string out = make_stringf("%d %d %d %d\n", stats.trials,
+                                 stats.speed_min, stats.speed_max,
+                                 stats.partial);
+  out += "X " + stats.exper.serialise() + "\n";
+  out += "A " + stats.mac.serialise() + "\n";
+  out += "E " + stats.mev.serialise() + "\n";
+  out += "H " + stats.hp.serialise() + "\n";
+  for (std::set<spell_set>::const_iterator i = stats.spells.begin();
+       i != stats.spells.end(); ++i)
+  {
+    out += "S ";
+    for (std::size_t j = 0; j < i->size(); ++j)
     {
-      target.append(" ");
-      target.append(argv[x]);
+      out += make_stringf("%s%d:%lld", j ? "," : "", (*i)[j].spell,
+                          (long long) (*i)[j].flags);
     }
+    out += "\n";
+  }
+  for (spell_damage_map::const_iterator i = stats.damages.begin();
+       i != stats.damages.end(); ++i)
+  {
+    for (std::size_t j = 0; j < i->second.damages.size(); ++j)
+      out += make_stringf("D %d\t", i->first) + i->second.damages[j] + "\n";
+  }
+  if (stats.items.trial_count())
+  {
+    const std::vector<std::string> item_lines =
+      split_string("\n", stats.items.serialise(), false);
+    for (std::size_t i = 0; i < item_lines.size(); ++i)
+      out += "I " + item_lines[i] + "\n";
+  }
+  return out;
+}
 
-  trim_string(target);
-
-  const bool want_vault_spec = target.find("spec:") == 0;
-  if (want_vault_spec)
+static bool deserialise_trial_stats(const std::string &data,
+                                    trial_stats &stats)
+{
+  std::string::size_type pos = data.find('\n');
+  int partial;
+  if (pos == std::string::npos
+      || sscanf(data.c_str(), "%d %d %d %d", &stats.trials,
+                &stats.speed_min, &stats.speed_max, &partial) != 4)
   {
-    target.erase(0, 5);
-    trim_string(target);
+    return false;
   }
+  stats.partial = partial;
 
-  // [ds] Nobody mess with cang.
-  for (unsigned i = 0; i < sizeof(canned_reports) / sizeof(*canned_reports);
-       ++i)
+  while (++pos < data.size())
   {
-    if (canned_reports[i][0] == target)
+    std::string::size_type eol = data.find('\n', pos);
+    if (eol == std::string::npos)
+      return false;
+    const std::string line = data.substr(pos, eol - pos);
+    pos = eol;
+
+    if (starts_with(line, "X ") || starts_with(line, "A ")
+        || starts_with(line, "E ") || starts_with(line, "H "))
     {
-      printf("%s\n", canned_reports[i][1].c_str());
-      return 0;
+      value_sketch &sketch = line[0] == 'X' ? stats.exper
+                             : line[0] == 'A' ? stats.mac
+                             : line[0] == 'E' ? stats.mev : stats.hp;
+      if (!sketch.deserialise(line.substr(2)))
+        return false;
+    }
+    else if (starts_with(line, "S "))
+    {
+      const std::vector<std::string> slots =
+        split_string(",", line.substr(2), false);
+      spell_set set;
+      for (std::size_t i = 0; i < slots.size(); ++i)
+      {
+        int spell;
+        long long flags;
+        if (sscanf(slots[i].c_str(), "%d:%lld", &spell, &flags) != 2)
+          return false;
+        spell_set_slot slot;
+        slot.spell = static_cast<spell_type>(spell);
+        slot.flags = static_cast<mon_spell_slot_flags>(flags);
+        set.push_back(slot);
+      }
+      stats.spells.insert(set);
+    }
+    else if (starts_with(line, "D "))
+    {
+      const std::string::size_type tab = line.find('\t');
+      if (tab == std::string::npos)
+        return false;
+      const spell_type spell =
+        static_cast<spell_type>(atoi(line.c_str() + 2));
+      add_spell_damage(stats.damages[spell], line.substr(tab + 1));
+    }
+    else if (starts_with(line, "I "))
+    {
+      if (!stats.items.deserialise_line(line.substr(2)))
+        return false;
     }
+    else
+      return false;
   }
+  return true;
+}
 
-  std::string orig_target = std::string(target);
+// Whether the standard error of the mean of a sampled value is within
+// the configured fraction of the mean.
+static bool mean_converged(const value_sketch &values)
+{
+  const double std_error = values.stddev() / sqrt(values.count());
+  return std_error <= qopts.confidence * std::max(fabs(values.mean()), 1.0);
+}
 
-  std::string err = mons.add_mons(target, false);
-  if (!err.empty()) {
-    target = "the " + target;
-    const std::string test = mons.add_mons(target, false);
-    if (test.empty())
-      err = test;
-  }
+static report_distribution report_distribution_of(const char *name,
+                                                  const value_sketch &values)
+{
+  report_distribution dist;
+  dist.name = name;
+  dist.mean = values.mean();
+  dist.stddev = values.stddev();
+  dist.p10 = values.quantile(0.1);
+  dist.p50 = values.quantile(0.5);
+  dist.p90 = values.quantile(0.9);
+  return dist;
+}
 
-  mons_spec spec = mons.get_monster(0);
-  monster_type spec_type = static_cast<monster_type>(spec.type);
-  bool vault_monster = false;
-  string vault_spec;
+static const char *item_slot_name(int slot)
+{
+  switch (slot)
+  {
+  case MSLOT_WEAPON:     return "weapon";
+  case MSLOT_ALT_WEAPON: return "alt weapon";
+  case MSLOT_MISSILE:    return "missile";
+  case MSLOT_ARMOUR:     return "armour";
+  case MSLOT_SHIELD:     return "shield";
+  case MSLOT_WAND:       return "wand";
+  case MSLOT_JEWELLERY:  return "jewellery";
+  case MSLOT_MISCELLANY: return "misc";
+  case MSLOT_SCROLL:     return "scroll";
+  case MSLOT_POTION:     return "potion";
+  default:               return "item";
+  }
+}
 
-  if ((spec_type < 0 || spec_type >= NUM_MONSTERS
-       || spec_type == MONS_PLAYER_GHOST)
-      || !err.empty())
+// Count what a sampled monster carries, by the items' numeric fields.
+static void record_items(const monster *mp, item_tally &items)
+{
+  items.add_trial();
+  for (int slot = 0; slot < NUM_MONSTER_SLOTS; ++slot)
   {
-    spec = get_vault_monster(orig_target, &vault_spec);
-    spec_type = static_cast<monster_type>(spec.type);
-    if (spec_type < 0 || spec_type >= NUM_MONSTERS
-        || spec_type == MONS_PLAYER_GHOST)
+    const int index = mp->inv[slot];
+    if (slot == MSLOT_GOLD || index == NON_ITEM || !mitm[index].defined())
+      continue;
+
+    const item_def &item = mitm[index];
+    item_tally_key key;
+    key.slot = slot;
+    key.base_type = item.base_type;
+    key.sub_type = item.sub_type;
+    key.randart = is_random_artefact(item);
+    key.unrand = is_unrandom_artefact(item) ? find_unrandart_index(item) : 0;
+    if (!is_artefact(item)
+        && (item.base_type == OBJ_WEAPONS || item.base_type == OBJ_ARMOUR
+            || item.base_type == OBJ_MISSILES))
     {
-      if (err.empty())
-        printf("unknown monster: \"%s\"\n", target.c_str());
-      else
-        printf("%s\n", err.c_str());
-      return 1;
+      key.ego = item.special;
     }
+    items.add(key, item.plus);
+  }
+}
 
-    // get_vault_monster created the monster; make uniques ungenerated again
-    if (mons_is_unique(spec_type))
-      you.unique_creatures.set(spec_type, false);
-
-    vault_monster = true;
+// The name of a kind of item in an item tally, with its ego.
+static std::string item_tally_name(const item_tally_key &key)
+{
+  if (key.unrand)
+  {
+    const unrandart_entry *entry = get_unrand_entry(key.unrand);
+    if (entry)
+      return entry->name;
   }
 
-  if (want_vault_spec)
+  item_def item;
+  item.base_type = static_cast<object_class_type>(key.base_type);
+  item.sub_type = key.sub_type;
+  item.special = key.ego;
+  item.quantity = 1;
+  std::string name = sub_type_string(item, true);
+  if (key.ego)
   {
-    if (!vault_monster)
-    {
-      printf("Not a vault monster: %s\n", orig_target.c_str());
-      return 1;
-    }
-    else
-    {
-      printf("%s: %s\n", orig_target.c_str(), vault_spec.c_str());
-      return 0;
-    }
+    const std::string ego = ego_type_string(item, true);
+    if (!ego.empty())
+      name += " (" + ego + ")";
   }
+  if (key.randart)
+    name += " (randart)";
+  return name;
+}
 
-  int index = mi_create_monster(spec);
-  if (index < 0 || index >= MAX_MONSTERS) {
-    printf("Failed to create test monster for %s\n", target.c_str());
-    return 1;
+/**
+ * The items of an item tally as report entries: by slot, then most common
+ * first.
+ */
+static std::vector<report_item> report_items(const item_tally &tally)
+{
+  std::vector<std::pair<item_tally_key, item_tally_count> > counts(
+    tally.counts().begin(), tally.counts().end());
+  std::stable_sort(counts.begin(), counts.end(),
+    [](const std::pair<item_tally_key, item_tally_count> &a,
+       const std::pair<item_tally_key, item_tally_count> &b)
+    {
+      if (a.first.slot != b.first.slot)
+        return a.first.slot < b.first.slot;
+      return a.second.count > b.second.count;
+    });
+
+  std::vector<report_item> items;
+  for (std::size_t i = 0; i < counts.size(); ++i)
+  {
+    report_item item;
+    item.slot = item_slot_name(counts[i].first.slot);
+    item.name = item_tally_name(counts[i].first);
+    item.chance = 100.0 * counts[i].second.count
+                  / std::max(1L, tally.trial_count());
+    item.plus_min = counts[i].second.plus.min();
+    item.plus_max = counts[i].second.plus.max();
+    items.push_back(item);
   }
+  return items;
+}
 
-  const int ntrials = 100;
+static bool trials_converged(const trial_stats &stats, int stale_trials)
+{
+  return stale_trials >= qopts.novelty_trials
+         && mean_converged(stats.exper)
+         && mean_converged(stats.mac)
+         && mean_converged(stats.mev);
+}
 
+/**
+ * Measure between min_trials and max_trials monsters generated from spec,
+ * starting with the one at index, stopping as soon as the stats converge.
+ * Each measured monster is destroyed and replaced by a freshly generated
+ * one, so on return index is a new, unmeasured monster.
+ *
+ * If another trial would likely run past the query's deadline, sampling
+ * stops early (even before min_trials) and stats is marked partial.
+ *
+ * Returns false (with an error in report) if a monster couldn't be made.
+ */
+static bool sample_trials(int &index, mons_spec &spec, std::string &target,
+                          monster_type spec_type, int min_trials,
+                          int max_trials, trial_stats &stats,
+                          std::string &report)
+{
+  // Trials in a row that didn't turn up anything new.
+  int stale_trials = 0;
+  spell_set set;
+  const double start = monotonic_ms();
 
-  long exper = 0L;
-  int hp_min = 0;
-  int hp_max = 0;
-  int mac = 0;
-  int mev = 0;
-  int speed_min = 0, speed_max = 0;
-  // Calculate averages.
-  std::set<std::string> spells;
-  spell_damage_map damages;
-  for (int i = 0; i < ntrials; ++i) {
-    monster *mp = &menv[index];
-    const std::string mname = mp->name(DESC_PLAIN, true);
-    exper += exper_value(mp);
-    mac += mp->armour_class();
-    mev += mp->evasion();
-    set_min_max(mp->speed, speed_min, speed_max);
-    set_min_max(mp->hit_points, hp_min, hp_max);
-
-    std::string new_spells;
-    const spell_damage_map new_damages = record_spell_set(mp, new_spells);
-    for (spell_damage_map::const_iterator i = new_damages.begin(); i != new_damages.end(); ++i)
-    {
-      bool skip = false;
-      std::pair<spell_damage_map::iterator, spell_damage_map::iterator> old_damages;
-      old_damages = damages.equal_range(i->first);
-      for (spell_damage_map::iterator j = old_damages.first; j != old_damages.second; ++j)
+  for (int i = 0; i < max_trials; ++i) {
+    if (i >= min_trials && trials_converged(stats, stale_trials))
+      break;
+
+    // Stop while there is still time to render what we have, keeping a
+    // tenth of the budget in hand for that.
+    if (i > 0 && deadline_active())
+    {
+      const double per_trial = (monotonic_ms() - start) / i;
+      if (deadline_remaining_ms() < per_trial + deadline_budget_ms() / 10)
       {
-        if (j->second == i->second)
-        {
-          skip = true;
-          break;
-        }
+        stats.partial = true;
+        break;
       }
-      if (skip) continue;
-      damages.insert(*i);
     }
-    if (!new_spells.empty())
-      spells.insert(new_spells);
+
+    TRACE_SPAN(span, "trial");
+    monster *mp = &menv[index];
+    const std::string mname = mp->name(DESC_PLAIN, true);
+    stats.exper.add(exper_value(mp));
+    stats.mac.add(mp->armour_class());
+    stats.mev.add(mp->evasion());
+
+    const long old_hp_min = stats.hp.min(), old_hp_max = stats.hp.max();
+    const int old_speed_min = stats.speed_min;
+    const int old_speed_max = stats.speed_max;
+
+    set_min_max(mp->speed, stats.speed_min, stats.speed_max);
+    stats.hp.add(mp->hit_points);
+    ++stats.trials;
+
+    const bool new_damage = record_spell_set(mp, set, stats.damages);
+    const bool new_set = !set.empty() && stats.spells.insert(set).second;
+
+    if (stats.hp.min() != old_hp_min || stats.hp.max() != old_hp_max
+        || stats.speed_min != old_speed_min
+        || stats.speed_max != old_speed_max
+        || new_set || new_damage)
+    {
+      stale_trials = 0;
+    }
+    else
+      ++stale_trials;
+
+    if (qopts.items)
+      record_items(mp, stats.items);
 
     // Destroy the monster.
     mp->reset();
@@ -778,23 +1111,312 @@ int main(int argc, char *argv[])
 
     index = mi_create_monster(spec);
     if (index == -1) {
-      printf("Unexpected failure generating monster for %s\n",
-             target.c_str());
-      return 1;
+      report += query_error(
+          make_stringf("Unexpected failure generating monster for %s",
+                       target.c_str()));
+      return false;
     }
   }
-  exper /= ntrials;
-  mac /= ntrials;
-  mev /= ntrials;
-
-  monster &mon(menv[index]);
+  return true;
+}
 
-  const std::string symbol(monster_symbol(mon));
+/**
+ * As sample_trials(), but split the trials between jobs forked workers,
+ * each with its own RNG seed, and merge their stats. Each worker applies
+ * the convergence test to its own share of the trials.
+ *
+ * The monster at index is left alone for the caller to describe.
+ */
+static bool sample_trials_forked(int &index, mons_spec &spec,
+                                 std::string &target, monster_type spec_type,
+                                 int min_trials, int max_trials, int jobs,
+                                 trial_stats &stats, std::string &report)
+{
+  // Settle on e.g. a draconian colour before forking, as the serial loop
+  // does after its first trial, so that every worker samples the same kind
+  // of monster.
+  rebind_mspec(&target, menv[index].name(DESC_PLAIN, true), &spec);
+
+  TRACE_SPAN(span, "sample_forked");
+  const uint32_t seed = random2(INT_MAX);
+  const int first_index = index;
+
+  std::vector<std::string> results;
+  const bool ok = run_forked_workers(jobs,
+    [&](int worker, std::string &result)
+    {
+      seed_rng(seed + worker);
 
-  const bool shapeshifter =
-      mon.is_shapeshifter()
-      || spec_type == MONS_SHAPESHIFTER
-      || spec_type == MONS_GLOWING_SHAPESHIFTER;
+      // Start from a monster generated with this worker's seed rather than
+      // the parent's.
+      menv[first_index].reset();
+      you.unique_creatures.set(spec_type, false);
+      int worker_index = mi_create_monster(spec);
+      if (worker_index == -1)
+        return false;
+
+      trial_stats worker_stats;
+      std::string worker_report;
+      if (!sample_trials(worker_index, spec, target, spec_type,
+                         worker_share(min_trials, worker, jobs),
+                         worker_share(max_trials, worker, jobs),
+                         worker_stats, worker_report))
+      {
+        return false;
+      }
+      result = serialise_trial_stats(worker_stats);
+      return true;
+    },
+    results);
+
+  for (unsigned int i = 0; ok && i < results.size(); ++i)
+  {
+    trial_stats worker_stats;
+    if (!deserialise_trial_stats(results[i], worker_stats))
+      break;
+    merge_trial_stats(stats, worker_stats);
+  }
+
+  if (!ok || !stats.trials)
+  {
+    report += query_error(
+        make_stringf("Unexpected failure generating monster for %s",
+                     target.c_str()));
+    return false;
+  }
+  return true;
+}
+
+// Built on demand rather than at static initialisation, so that they're
+// coloured for the backend chosen on the command line.
+static std::string canned_report(const std::string &target)
+{
+  if (target == "cang")
+    return ("cang (" + colour(LIGHTRED, "Ω")
+            + (") | Spd: c | HD: i | HP: 666 | AC/EV: e/π | Dam: 999"
+               " | Res: sanity | XP: ∞ | Int: god | Sz: !!!"));
+  return "";
+}
+
+// How many names --complete and "did you mean" offer.
+#define MAX_COMPLETIONS 20
+#define MAX_SUGGESTIONS 5
+
+static name_index monster_names;
+
+/**
+ * The names of every monster type and indexed vault monster, for
+ * completion and suggestions. Built on first use, and rebuilt when a
+ * regenerated vault monster pack is picked up. The type names come from
+ * the pack when it was indexed by this version of crawl, so that crawl
+ * needn't be initialised; otherwise they are computed, once.
+ */
+static const name_index &monster_name_index()
+{
+  static std::vector<std::string> type_names;
+  static int pack_generation = -1;
+
+  const vault_pack &pack = current_vault_pack();
+  if (pack.generation() != pack_generation)
+  {
+    pack_generation = pack.generation();
+    monster_names = name_index();
+    if (pack.type_name_count() > 0
+        && !strcmp(pack.version(), Version::Long))
+    {
+      for (int i = 0; i < pack.type_name_count(); ++i)
+        monster_names.add(pack.type_name(i));
+    }
+    else
+    {
+      if (type_names.empty())
+      {
+        initialize_crawl();
+        type_names = monster_type_names();
+      }
+      for (unsigned int i = 0; i < type_names.size(); ++i)
+        monster_names.add(type_names[i]);
+    }
+    for (int i = 0; i < pack.index_count(); ++i)
+      monster_names.add(pack.index_name(i));
+    monster_names.build();
+  }
+  return monster_names;
+}
+
+// " (did you mean: x, y?)" for a name that wasn't found, or "".
+static std::string did_you_mean(const std::string &name)
+{
+  const std::vector<std::string> suggestions =
+    monster_name_index().suggest(name, MAX_SUGGESTIONS);
+  if (suggestions.empty())
+    return "";
+
+  std::string text;
+  for (unsigned int i = 0; i < suggestions.size(); ++i)
+  {
+    if (i)
+      text += ", ";
+    text += suggestions[i];
+  }
+  return " (did you mean: " + text + "?)";
+}
+
+static int describe_monster(mons_spec spec, std::string target,
+                            bool vault_monster, std::string &report,
+                            monster_report *gathered = 0);
+
+/**
+ * Run a single monster query and append the report (or error message) to
+ * report. Returns the exit status main() should use for this query.
+ *
+ * The caller is responsible for resetting the sandbox with
+ * sandbox_restore() before running another query in the same process.
+ */
+static int monster_query(std::string target, std::string &report,
+                         monster_report *gathered = 0)
+{
+  TRACE_SPAN(query_span, "query");
+  mons_list mons;
+
+  trim_string(target);
+  if (target.empty())
+  {
+    report += "Usage: @? <monster name>\n";
+    return 0;
+  }
+
+  const bool want_vault_spec = target.find("spec:") == 0;
+  if (want_vault_spec)
+  {
+    target.erase(0, 5);
+    trim_string(target);
+  }
+
+  // [ds] Nobody mess with cang.
+  const std::string canned = canned_report(target);
+  if (!canned.empty())
+  {
+    report += canned + "\n";
+    return 0;
+  }
+
+  std::string orig_target = std::string(target);
+
+  TRACE_SPAN(parse_span, "parse");
+  std::string err = mons.add_mons(target, false);
+  if (!err.empty()) {
+    target = "the " + target;
+    const std::string test = mons.add_mons(target, false);
+    if (test.empty())
+      err = test;
+  }
+
+  mons_spec spec = mons.get_monster(0);
+  monster_type spec_type = static_cast<monster_type>(spec.type);
+  bool vault_monster = false;
+  string vault_spec;
+  TRACE_END(parse_span);
+
+  if ((spec_type < 0 || spec_type >= NUM_MONSTERS
+       || spec_type == MONS_PLAYER_GHOST)
+      || !err.empty())
+  {
+    TRACE_SPAN(vault_span, "vault_lookup");
+    spec = get_vault_monster(orig_target, &vault_spec);
+    TRACE_END(vault_span);
+    spec_type = static_cast<monster_type>(spec.type);
+    if (spec_type < 0 || spec_type >= NUM_MONSTERS
+        || spec_type == MONS_PLAYER_GHOST)
+    {
+      if (deadline_expired())
+      {
+        report += query_error(
+            make_stringf("ran out of time looking up vault monster: \"%s\"",
+                         orig_target.c_str()));
+        return 1;
+      }
+
+      std::string message =
+        err.empty() ? make_stringf("unknown monster: \"%s\"", target.c_str())
+                    : err;
+      trim_string(message);
+      report += query_error(message + did_you_mean(orig_target));
+      return 1;
+    }
+
+    // get_vault_monster created the monster; make uniques ungenerated again
+    if (mons_is_unique(spec_type))
+      you.unique_creatures.set(spec_type, false);
+
+    vault_monster = true;
+  }
+
+  if (want_vault_spec)
+  {
+    if (!vault_monster)
+    {
+      report += query_error(
+          make_stringf("Not a vault monster: %s", orig_target.c_str()));
+      return 1;
+    }
+    else
+    {
+      report += make_stringf("%s: %s\n", orig_target.c_str(), vault_spec.c_str());
+      return 0;
+    }
+  }
+
+  return describe_monster(spec, target, vault_monster, report, gathered);
+}
+
+/**
+ * Sample monsters generated from spec and append the report describing
+ * them. target is the name the monster was asked for by. If gathered is
+ * set, the stats are also copied there.
+ */
+static int describe_monster(mons_spec spec, std::string target,
+                            bool vault_monster, std::string &report,
+                            monster_report *gathered)
+{
+  const monster_type spec_type = static_cast<monster_type>(spec.type);
+  damage_cache.clear();
+
+  int index = mi_create_monster(spec);
+  if (index < 0 || index >= MAX_MONSTERS) {
+    report += query_error(
+        make_stringf("Failed to create test monster for %s", target.c_str()));
+    return 1;
+  }
+
+  // Calculate averages.
+  trial_stats stats;
+  const bool sampled =
+    qopts.jobs > 1
+    ? sample_trials_forked(index, spec, target, spec_type, qopts.min_trials,
+                           qopts.max_trials, qopts.jobs, stats, report)
+    : sample_trials(index, spec, target, spec_type, qopts.min_trials,
+                    qopts.max_trials, stats, report);
+  if (!sampled)
+    return 1;
+
+  TRACE_SPAN(render_span, "render");
+  // Truncated, as the integer averages of the one-line report always were.
+  const long exper = (long) stats.exper.mean();
+  const int mac = (int) stats.mac.mean();
+  const int mev = (int) stats.mev.mean();
+  const int hp_min = stats.hp.min(), hp_max = stats.hp.max();
+  const int speed_min = stats.speed_min, speed_max = stats.speed_max;
+  const std::set<spell_set> &spells = stats.spells;
+  const spell_damage_map &damages = stats.damages;
+
+  monster &mon(menv[index]);
+
+
+  const bool shapeshifter =
+      mon.is_shapeshifter()
+      || spec_type == MONS_SHAPESHIFTER
+      || spec_type == MONS_GLOWING_SHAPESHIFTER;
 
   const bool nonbase =
       mons_species(mon.type) == MONS_DRACONIAN
@@ -812,10 +1434,7 @@ int main(int argc, char *argv[])
 
   if (me)
   {
-    std::string monsterflags;
-    std::string monsterresistances;
-    std::string monstervulnerabilities;
-    std::string monsterattacks;
+    monster_report rep;
 
     lowercase(target);
 
@@ -823,36 +1442,23 @@ int main(int argc, char *argv[])
       mon.has_hydra_multi_attack() || mon.type == MONS_PANDEMONIUM_LORD
         || shapeshifter || mon.type == MONS_DANCING_WEAPON;
 
-    printf("%s (%s)",
-           changing_name ? me->name : mon.name(DESC_PLAIN, true).c_str(),
-           symbol.c_str());
+    rep.name = changing_name ? me->name : mon.name(DESC_PLAIN, true);
+    rep.glyph = monster_symbol(mon);
+    rep.unfinished = mons_class_flag(mon.type, M_UNFINISHED);
 
-    if (mons_class_flag(mon.type, M_UNFINISHED))
-        printf(" | %s", colour(LIGHTRED, "UNFINISHED").c_str());
-
-    printf(" | Spd: %s",
-           monster_speed(mon, me, speed_min, speed_max).c_str());
+    monster_speed(mon, speed_min, speed_max, rep);
 
     const int hd = mon.get_experience_level();
-    printf(" | HD: %d", hd);
-
-    printf(" | HP: ");
-    const int hplow = hp_min;
-    const int hphigh = hp_max;
-    if (hplow < hphigh)
-        printf("%i-%i", hplow, hphigh);
-    else
-        printf("%i", hplow);
-
-    printf(" | AC/EV: %i/%i", mac, mev);
+    rep.hd = hd;
+    rep.hp_min = hp_min;
+    rep.hp_max = hp_max;
+    rep.ac = mac;
+    rep.ev = mev;
 
-    std::string defenses;
     if (mon.is_spiny() > 0)
-        defenses += colour(YELLOW, "(spiny 5d4)");
+        rep.defenses.push_back(report_token(YELLOW, "(spiny 5d4)"));
     if (mons_species(mons_base_type(&mon)) == MONS_MINOTAUR)
-        defenses += colour(LIGHTRED, "(headbutt: d20-1)");
-    if (defenses != "")
-        printf(" %s", defenses.c_str());
+        rep.defenses.push_back(report_token(LIGHTRED, "(headbutt: d20-1)"));
 
     mon.wield_melee_weapon();
     for (int x = 0; x < 4; x++)
@@ -864,10 +1470,7 @@ int main(int argc, char *argv[])
       mon_attack_def attk = mons_attack_spec(&mon, attack_num);
       if (attk.type)
       {
-        if (monsterattacks.empty())
-          monsterattacks = " | Dam: ";
-        else
-          monsterattacks += ", ";
+        report_attack attack;
 
         int frenzy_degree = -1;
         short int dam = attk.damage;
@@ -884,13 +1487,13 @@ int main(int argc, char *argv[])
         if (mon.has_ench(ENCH_WEAK))
           dam = dam * 2 / 3;
 
-        monsterattacks += to_string(dam);
+        attack.damage = dam;
 
         if (attk.type == AT_CONSTRICT)
-            monsterattacks += colour(GREEN, "(constrict)");
+            attack.flavours.push_back(report_token(GREEN, "(constrict)"));
         
         if (attk.type == AT_CLAW && mon.has_claws() >= 3)
-            monsterattacks += colour(LIGHTGREEN, "(claw)");
+            attack.flavours.push_back(report_token(LIGHTGREEN, "(claw)"));
 
         const attack_flavour flavour(
             orig_attk.flavour == AF_KLOWN || orig_attk.flavour == AF_DRAIN_STAT
@@ -900,135 +1503,135 @@ int main(int argc, char *argv[])
         {
         case AF_REACH:
         case AF_REACH_STING:
-          monsterattacks += "(reach)";
+          attack.flavours.push_back("(reach)");
           break;
         case AF_KITE:
-          monsterattacks += "(kite)";
+          attack.flavours.push_back("(kite)");
           break;
         case AF_SWOOP:
-          monsterattacks += "(swoop)";
+          attack.flavours.push_back("(swoop)");
           break;
         case AF_ACID:
-          monsterattacks += colour(YELLOW,
-                                   damage_flavour("acid", "7d3"));
+          attack.flavours.push_back(
+              report_token(YELLOW, damage_flavour("acid", "7d3")));
           break;
         case AF_BLINK:
-          monsterattacks += colour(MAGENTA, "(blink self)");
+          attack.flavours.push_back(report_token(MAGENTA, "(blink self)"));
           break;
         case AF_COLD:
-          monsterattacks +=
-            colour(LIGHTBLUE, damage_flavour("cold", hd, 3 * hd - 1));
+          attack.flavours.push_back(
+              report_token(LIGHTBLUE, damage_flavour("cold", hd, 3 * hd - 1)));
           break;
         case AF_CONFUSE:
-          monsterattacks += colour(LIGHTMAGENTA,"(confuse)");
+          attack.flavours.push_back(report_token(LIGHTMAGENTA,"(confuse)"));
           break;
         case AF_DRAIN_DEX:
-          monsterattacks += colour(RED,"(drain dexterity)");
+          attack.flavours.push_back(report_token(RED,"(drain dexterity)"));
           break;
         case AF_DRAIN_STR:
-          monsterattacks += colour(RED,"(drain strength)");
+          attack.flavours.push_back(report_token(RED,"(drain strength)"));
           break;
         case AF_DRAIN_XP:
-          monsterattacks += colour(LIGHTMAGENTA, "(drain)");
+          attack.flavours.push_back(report_token(LIGHTMAGENTA, "(drain)"));
           break;
         case AF_CHAOS:
-          monsterattacks += colour(LIGHTGREEN, "(chaos)");
+          attack.flavours.push_back(report_token(LIGHTGREEN, "(chaos)"));
           break;
         case AF_ELEC:
-          monsterattacks +=
-            colour(LIGHTCYAN,
-                   damage_flavour("elec", hd, hd + std::max(hd / 2 - 1, 0)));
+          attack.flavours.push_back(
+              report_token(LIGHTCYAN,
+                           damage_flavour("elec", hd, hd + std::max(hd / 2 - 1, 0))));
           break;
         case AF_FIRE:
-          monsterattacks +=
-            colour(LIGHTRED, damage_flavour("fire", hd, hd * 2 - 1));
+          attack.flavours.push_back(
+              report_token(LIGHTRED, damage_flavour("fire", hd, hd * 2 - 1)));
           break;
         case AF_PURE_FIRE:
-          monsterattacks +=
-            colour(LIGHTRED, damage_flavour("pure fire", hd*3/2, hd*5/2 - 1));
+          attack.flavours.push_back(
+              report_token(LIGHTRED, damage_flavour("pure fire", hd*3/2, hd*5/2 - 1)));
           break;
         case AF_STICKY_FLAME:
-          monsterattacks += colour(LIGHTRED, "(napalm)");
+          attack.flavours.push_back(report_token(LIGHTRED, "(napalm)"));
           break;
         case AF_HUNGER:
-          monsterattacks += colour(BLUE, "(hunger)");
+          attack.flavours.push_back(report_token(BLUE, "(hunger)"));
           break;
         case AF_MUTATE:
-          monsterattacks += colour(LIGHTGREEN, "(mutation)");
+          attack.flavours.push_back(report_token(LIGHTGREEN, "(mutation)"));
           break;
         case AF_PARALYSE:
-          monsterattacks += colour(LIGHTRED, "(paralyse)");
+          attack.flavours.push_back(report_token(LIGHTRED, "(paralyse)"));
           break;
         case AF_POISON:
-          monsterattacks +=
-            colour(YELLOW, damage_flavour("poison", hd*2, hd*4));
+          attack.flavours.push_back(
+              report_token(YELLOW, damage_flavour("poison", hd*2, hd*4)));
           break;
         case AF_POISON_STRONG:
-          monsterattacks +=
-            colour(LIGHTRED, damage_flavour("strong poison", hd*11/3, hd*13/2));
+          attack.flavours.push_back(
+              report_token(LIGHTRED, damage_flavour("strong poison", hd*11/3, hd*13/2)));
           break;
         case AF_ROT:
-          monsterattacks += colour(LIGHTRED,"(rot)");
+          attack.flavours.push_back(report_token(LIGHTRED,"(rot)"));
           break;
         case AF_VAMPIRIC:
-          monsterattacks += colour(RED,"(vampiric)");
+          attack.flavours.push_back(report_token(RED,"(vampiric)"));
           break;
         case AF_KLOWN:
-          monsterattacks += colour(LIGHTBLUE,"(klown)");
+          attack.flavours.push_back(report_token(LIGHTBLUE,"(klown)"));
           break;
         case AF_SCARAB:
-          monsterattacks += colour(LIGHTMAGENTA,"(scarab)");
+          attack.flavours.push_back(report_token(LIGHTMAGENTA,"(scarab)"));
           break;
         case AF_DISTORT:
-          monsterattacks += colour(LIGHTBLUE,"(distort)");
+          attack.flavours.push_back(report_token(LIGHTBLUE,"(distort)"));
           break;
         case AF_RAGE:
-          monsterattacks += colour(RED,"(rage)");
+          attack.flavours.push_back(report_token(RED,"(rage)"));
           break;
         case AF_HOLY:
-          monsterattacks += colour(YELLOW,"(holy)");
+          attack.flavours.push_back(report_token(YELLOW,"(holy)"));
           break;
         case AF_PAIN:
-          monsterattacks += colour(RED,"(pain)");
+          attack.flavours.push_back(report_token(RED,"(pain)"));
           break;
         case AF_ANTIMAGIC:
-          monsterattacks += colour(LIGHTBLUE,"(antimagic)");
+          attack.flavours.push_back(report_token(LIGHTBLUE,"(antimagic)"));
           break;
         case AF_DRAIN_INT:
-          monsterattacks += colour(BLUE, "(drain int)");
+          attack.flavours.push_back(report_token(BLUE, "(drain int)"));
           break;
         case AF_DRAIN_STAT:
-          monsterattacks += colour(BLUE, "(drain stat)");
+          attack.flavours.push_back(report_token(BLUE, "(drain stat)"));
           break;
         case AF_STEAL:
-          monsterattacks += colour(CYAN, "(steal)");
+          attack.flavours.push_back(report_token(CYAN, "(steal)"));
           break;
         case AF_ENSNARE:
-          monsterattacks += colour(WHITE, "(ensnare)");
+          attack.flavours.push_back(report_token(WHITE, "(ensnare)"));
           break;
         case AF_DROWN:
-          monsterattacks += colour(LIGHTBLUE, "(drown)");
+          attack.flavours.push_back(report_token(LIGHTBLUE, "(drown)"));
           break;
         case AF_ENGULF:
-          monsterattacks += colour(LIGHTBLUE, "(engulf)");
+          attack.flavours.push_back(report_token(LIGHTBLUE, "(engulf)"));
           break;
         case AF_DRAIN_SPEED:
-          monsterattacks += colour(LIGHTMAGENTA, "(drain speed)");
+          attack.flavours.push_back(report_token(LIGHTMAGENTA, "(drain speed)"));
           break;
         case AF_VULN:
-          monsterattacks += colour(LIGHTBLUE, "(vuln)");
+          attack.flavours.push_back(report_token(LIGHTBLUE, "(vuln)"));
           break;
         case AF_SHADOWSTAB:
-          monsterattacks += colour(MAGENTA, "(shadow stab)");
+          attack.flavours.push_back(report_token(MAGENTA, "(shadow stab)"));
           break;
         case AF_CORRODE:
-          monsterattacks += colour(BROWN, "(corrosion)");
+          attack.flavours.push_back(report_token(BROWN, "(corrosion)"));
           break;
         case AF_TRAMPLE:
-          monsterattacks += colour(BROWN, "(trample)");
+          attack.flavours.push_back(report_token(BROWN, "(trample)"));
           break;
         case AF_WEAKNESS:
-          monsterattacks += colour(LIGHTRED, "(weakness)");
+          attack.flavours.push_back(report_token(LIGHTRED, "(weakness)"));
           break;
         case AF_CRUSH:
         case AF_PLAIN:
@@ -1044,38 +1647,36 @@ int main(int argc, char *argv[])
         case AF_POISON_INT:
         case AF_POISON_STAT:
 	case AF_FIREBRAND:
-          monsterattacks += colour(LIGHTRED, "(?\?\?)");
+          attack.flavours.push_back(report_token(LIGHTRED, "(?\?\?)"));
           break;
 #endif
 // let the compiler issue warnings for us
 //      default:
-//        monsterattacks += "(???)";
+//        attack.flavours.push_back("(???)");
 //        break;
         }
 
-        if (x == 0 && mon.has_hydra_multi_attack())
-          monsterattacks += " per head";
+        attack.per_head = x == 0 && mon.has_hydra_multi_attack();
+        rep.attacks.push_back(attack);
       }
     }
 
-    printf("%s", monsterattacks.c_str());
-
     switch (me->holiness)
     {
     case MH_HOLY:
-      mons_flag(monsterflags, colour(YELLOW, "holy"));
+      mons_flag(rep.flags, report_token(YELLOW, "holy"));
       break;
     case MH_UNDEAD:
-      mons_flag(monsterflags, colour(BROWN, "undead"));
+      mons_flag(rep.flags, report_token(BROWN, "undead"));
       break;
     case MH_DEMONIC:
-      mons_flag(monsterflags, colour(RED, "demonic"));
+      mons_flag(rep.flags, report_token(RED, "demonic"));
       break;
     case MH_NONLIVING:
-      mons_flag(monsterflags, colour(LIGHTCYAN, "non-living"));
+      mons_flag(rep.flags, report_token(LIGHTCYAN, "non-living"));
       break;
     case MH_PLANT:
-      mons_flag(monsterflags, colour(GREEN, "plant"));
+      mons_flag(rep.flags, report_token(GREEN, "plant"));
       break;
     case MH_NATURAL:
     default:
@@ -1085,50 +1686,49 @@ int main(int argc, char *argv[])
     switch (me->gmon_use)
     {
       case MONUSE_WEAPONS_ARMOUR:
-        mons_flag(monsterflags, colour(CYAN, "weapons"));
+        mons_flag(rep.flags, report_token(CYAN, "weapons"));
       // intentional fall-through
       case MONUSE_STARTING_EQUIPMENT:
-        mons_flag(monsterflags, colour(CYAN, "items"));
+        mons_flag(rep.flags, report_token(CYAN, "items"));
       // intentional fall-through
       case MONUSE_OPEN_DOORS:
-        mons_flag(monsterflags, colour(CYAN, "doors"));
+        mons_flag(rep.flags, report_token(CYAN, "doors"));
       // intentional fall-through
       case MONUSE_NOTHING:
         break;
 
       case NUM_MONUSE:  // Can't happen
-        mons_flag(monsterflags, colour(CYAN, "uses bugs"));
+        mons_flag(rep.flags, report_token(CYAN, "uses bugs"));
         break;
     }
 
-    mons_check_flag(bool(me->bitfields & M_EAT_ITEMS), monsterflags, colour(LIGHTRED, "eats items"));
-    mons_check_flag(bool(me->bitfields & M_CRASH_DOORS), monsterflags, colour(LIGHTRED, "breaks doors"));
+    mons_check_flag(bool(me->bitfields & M_EAT_ITEMS), rep.flags, report_token(LIGHTRED, "eats items"));
+    mons_check_flag(bool(me->bitfields & M_CRASH_DOORS), rep.flags, report_token(LIGHTRED, "breaks doors"));
 
-    mons_check_flag(mons_wields_two_weapons(&mon), monsterflags, "two-weapon");
-    mons_check_flag(mon.is_fighter(), monsterflags, "fighter");
+    mons_check_flag(mons_wields_two_weapons(&mon), rep.flags, "two-weapon");
+    mons_check_flag(mon.is_fighter(), rep.flags, "fighter");
     if (mon.is_archer())
     {
       if (me->bitfields & M_DONT_MELEE)
-        mons_flag(monsterflags, "master archer");
+        mons_flag(rep.flags, "master archer");
       else
-        mons_flag(monsterflags, "archer");
+        mons_flag(rep.flags, "archer");
     }
-    mons_check_flag(mon.is_priest(), monsterflags, "priest");
+    mons_check_flag(mon.is_priest(), rep.flags, "priest");
 
     mons_check_flag(me->habitat == HT_AMPHIBIOUS,
-                    monsterflags, "amphibious");
+                    rep.flags, "amphibious");
 
-    mons_check_flag(mon.is_evil(), monsterflags, "evil");
+    mons_check_flag(mon.is_evil(), rep.flags, "evil");
     mons_check_flag(mon.is_actual_spellcaster(),
-                    monsterflags, "spellcaster");
-    mons_check_flag(bool(me->bitfields & M_COLD_BLOOD), monsterflags, "cold-blooded");
-    mons_check_flag(bool(me->bitfields & M_SEE_INVIS), monsterflags, "see invisible");
-    mons_check_flag(bool(me->bitfields & M_FLIES), monsterflags, "fly");
-    mons_check_flag(bool(me->bitfields & M_FAST_REGEN), monsterflags, "regen");
-    mons_check_flag(bool(me->bitfields & M_WEB_SENSE), monsterflags, "web sense");
-    mons_check_flag(mon.is_unbreathing(), monsterflags, "unbreathing");
-
-    std::string spell_string = construct_spells(spells, damages);
+                    rep.flags, "spellcaster");
+    mons_check_flag(bool(me->bitfields & M_COLD_BLOOD), rep.flags, "cold-blooded");
+    mons_check_flag(bool(me->bitfields & M_SEE_INVIS), rep.flags, "see invisible");
+    mons_check_flag(bool(me->bitfields & M_FLIES), rep.flags, "fly");
+    mons_check_flag(bool(me->bitfields & M_FAST_REGEN), rep.flags, "regen");
+    mons_check_flag(bool(me->bitfields & M_WEB_SENSE), rep.flags, "web sense");
+    mons_check_flag(mon.is_unbreathing(), rep.flags, "unbreathing");
+
     if (shapeshifter
         || mon.type == MONS_PANDEMONIUM_LORD
         || mon.type == MONS_LICH
@@ -1138,41 +1738,35 @@ int main(int argc, char *argv[])
                || mon.base_monster == MONS_LICH
                || mon.base_monster == MONS_ANCIENT_LICH))
     {
-      spell_string = "(random)";
+      rep.random_spells = true;
     }
+    else
+      rep.spell_sets = construct_spells(&mon, spells, damages);
 
-    mons_check_flag(vault_monster, monsterflags, colour(BROWN, "vault"));
-
-    printf("%s", monsterflags.c_str());
+    mons_check_flag(vault_monster, rep.flags, report_token(BROWN, "vault"));
 
-    if (me->resist_magic == 5000)
+    if (me->resist_magic)
     {
-      if (monsterresistances.empty())
-        monsterresistances = " | Res: ";
-      else
-        monsterresistances += ", ";
-      monsterresistances += colour(LIGHTMAGENTA, "magic(immune)");
-    }
-    else if (me->resist_magic < 0)
-    {
-      const int res = (mbase) ? mbase->resist_magic : me->resist_magic;
-      if (monsterresistances.empty())
-        monsterresistances = " | Res: ";
-      else
-        monsterresistances += ", ";
-      monsterresistances += colour(MAGENTA, std::string() + "magic("
-                                   + to_string((short int) hd * res * 4 / 3 * -1)
-                                   + ")");
-    }
-    else if (me->resist_magic > 0)
-    {
-      if (monsterresistances.empty())
-        monsterresistances = " | Res: ";
+      report_resist mr;
+      mr.name = "magic";
+      mr.level = 1;
+      if (me->resist_magic == 5000)
+      {
+        mr.colour = LIGHTMAGENTA;
+        mr.detail = "immune";
+      }
+      else if (me->resist_magic < 0)
+      {
+        const int res = (mbase) ? mbase->resist_magic : me->resist_magic;
+        mr.colour = MAGENTA;
+        mr.detail = make_stringf("%d", (short int) hd * res * 4 / 3 * -1);
+      }
       else
-        monsterresistances += ", ";
-      monsterresistances += colour(MAGENTA, std::string("magic(")
-                                   + to_string((short int) me->resist_magic)
-                                   + ")");
+      {
+        mr.colour = MAGENTA;
+        mr.detail = make_stringf("%d", (short int) me->resist_magic);
+      }
+      rep.resists.push_back(mr);
     }
 
     const resists_t res(
@@ -1181,8 +1775,7 @@ int main(int argc, char *argv[])
     do                                            \
     {                                             \
       record_resist(c,lowercase_string(#x),       \
-                    monsterresistances,           \
-                    monstervulnerabilities,       \
+                    rep.resists,                  \
                     get_resist(res, MR_RES_##x)); \
     } while (false)                               \
 
@@ -1190,8 +1783,7 @@ int main(int argc, char *argv[])
     do                                            \
     {                                             \
       record_resist(c,#x,                         \
-                    monsterresistances,           \
-                    monstervulnerabilities,       \
+                    rep.resists,                  \
                     y);                           \
     } while (false)                               \
 
@@ -1221,53 +1813,1252 @@ int main(int argc, char *argv[])
     res2(LIGHTRED,     napalm, mon.res_sticky_flame());
     res2(LIGHTCYAN,    silver, mon.how_chaotic() ? -1 : 0);
 
-    printf("%s", monsterresistances.c_str());
-    printf("%s", monstervulnerabilities.c_str());
-
     if (me->corpse_thingy != CE_NOCORPSE && me->corpse_thingy != CE_CLEAN)
     {
-      printf(" | Chunks: ");
       switch (me->corpse_thingy)
       {
       case CE_NOXIOUS:
-        printf("%s", colour(DARKGREY,"noxious").c_str());
+        rep.chunks = report_token(DARKGREY, "noxious");
         break;
       case CE_MUTAGEN:
-        printf("%s", colour(MAGENTA, "mutagenic").c_str());
+        rep.chunks = report_token(MAGENTA, "mutagenic");
         break;
       // We should't get here; including these values so we can get compiler
       // warnings for unhandled enum values.
       case CE_NOCORPSE:
       case CE_CLEAN:
-        printf("???");
+        rep.chunks = "???";
       }
     }
 
-    printf(" | XP: %ld", exper);
+    rep.xp = exper;
+    rep.size = monster_size(mon);
+    rep.intelligence = monster_int(mon);
+    rep.trials = stats.trials;
+    rep.partial = stats.partial;
+    if (qopts.distributions)
+    {
+      rep.distributions.push_back(report_distribution_of("hp", stats.hp));
+      rep.distributions.push_back(report_distribution_of("ac", stats.mac));
+      rep.distributions.push_back(report_distribution_of("ev", stats.mev));
+      rep.distributions.push_back(report_distribution_of("xp", stats.exper));
+    }
+    if (qopts.items)
+      rep.items = report_items(stats.items);
+
+    emit_report(rep, qopts.format, qopts.show_trials, show_partial(),
+                report);
+    if (gathered)
+      *gathered = rep;
+
+    return 0;
+  }
+  return 1;
+}
+
+static monster_db query_db;
+
+/**
+ * Answer a query from the --db database. Misses (including every query
+ * against a database exported by another crawl version) are left to be
+ * computed live.
+ */
+static bool db_query(const std::string &query, std::string &report)
+{
+  // The stored reports were rendered without trial counts, distributions
+  // or items, or the CSV columns for partial reports, and may have been
+  // sampled with other trial settings (checked below).
+  if (qopts.db_path.empty() || qopts.show_trials || qopts.distributions
+      || qopts.items || (qopts.format == REPORT_CSV && show_partial()))
+    return false;
+
+  static bool opened = false;
+  if (!opened)
+  {
+    opened = true;
+    if (!query_db.open(qopts.db_path))
+      fprintf(stderr, "Can't read monster database: %s\n",
+              qopts.db_path.c_str());
+  }
+
+  return query_db.version() == Version::Long
+         && query_db.settings() == trial_settings()
+         && query_db.lookup(query, qopts.format, report);
+}
+
+static result_cache query_cache;
+
+/**
+ * The result cache key for a query: the normalised name and everything
+ * else that changes the report. The crawl version is checked by the cache
+ * itself. spec: queries echo the name as given, so it is kept as is.
+ */
+static std::string result_cache_key(std::string query)
+{
+  trim_string(query);
+  if (query.find("spec:") != 0)
+    query = monster_db_key(query);
+
+  return make_stringf("%d %d %d %d %d %d %d %d %d %g ", qopts.format,
+                      current_colour_backend(), qopts.show_trials,
+                      show_partial(), qopts.distributions, qopts.items,
+                      qopts.min_trials, qopts.max_trials,
+                      qopts.novelty_trials, qopts.confidence) + query;
+}
+
+// Answer a query from the --cache result cache.
+static bool cached_query(const std::string &query, std::string &report)
+{
+  if (qopts.cache_path.empty())
+    return false;
+
+  static bool opened = false;
+  if (!opened)
+  {
+    opened = true;
+    if (!query_cache.open(qopts.cache_path, Version::Long))
+      fprintf(stderr, "Can't open result cache: %s\n",
+              qopts.cache_path.c_str());
+  }
 
-    if (!spell_string.empty())
-      printf(" | Sp: %s", spell_string.c_str());
+  std::string cached;
+  if (!query_cache.lookup(result_cache_key(query), cached))
+    return false;
+  report += cached;
+  return true;
+}
 
-    printf(" | Sz: %s",
-           monster_size(mon).c_str());
+/**
+ * Compute a query that wasn't answered by the result cache or database,
+ * and add successful reports to the result cache. Reports cut short by
+ * the deadline aren't cached, so a later query can do better.
+ */
+static int live_query(const std::string &query, std::string &report)
+{
+  initialize_crawl();
 
-    printf(" | Int: %s",
-           monster_int(mon).c_str());
+  std::string result;
+  monster_report rep;
+  const int status = monster_query(query, result, &rep);
+  if (!status && !rep.partial && query_cache.is_open())
+    query_cache.store(result_cache_key(query), result);
+  report += result;
+  return status;
+}
 
-    printf(".\n");
+/**
+ * Seconds before the alarm kills a query. With a --deadline the query
+ * stops itself in time, so the alarm is only a backstop for one that
+ * hangs, set a little past the deadline.
+ */
+static unsigned int query_alarm_seconds()
+{
+  return std::max(5, (qopts.deadline_ms + 999) / 1000 + 2);
+}
 
+/**
+ * Run one of many queries in a long-lived process. Each live query runs in
+ * a forked child under its own deadline and alarm, so a runaway query
+ * only kills the child: it gets an error report and the server or batch
+ * carries on. Whatever the query does to crawl's state dies with the
+ * child, so every query starts from the same clean slate.
+ */
+static int run_isolated_query(const std::string &query, std::string &report)
+{
+  if (cached_query(query, report) || db_query(query, report))
     return 0;
+
+  // Initialise in the parent, and keep the name index for suggestions up
+  // to date there, so that the work is done once and not per child.
+  initialize_crawl();
+  monster_name_index();
+
+  deadline_start(qopts.deadline_ms);
+  const unsigned int timeout = query_alarm_seconds();
+  std::vector<std::string> results;
+  const bool ok = run_forked_workers(1,
+    [&](int, std::string &result)
+    {
+      alarm(timeout);
+      // The status goes on the first line, so that the report of a query
+      // that failed still reaches the parent.
+      std::string query_report;
+      const int status = live_query(query, query_report);
+      result = make_stringf("%d\n", status) + query_report;
+      return true;
+    },
+    results);
+  deadline_clear();
+
+  std::string::size_type eol = std::string::npos;
+  if (ok && !results.empty())
+    eol = results[0].find('\n');
+  if (eol == std::string::npos)
+  {
+    report += query_error(
+        make_stringf("Query for %s timed out or crashed", query.c_str()));
+    return 1;
   }
-  return 1;
+  report += results[0].substr(eol + 1);
+  return atoi(results[0].c_str());
 }
 
-template <class T> inline std::string to_string (const T& t)
+/**
+ * Answer one query per line of the given file ("-" for stdin), sharing a
+ * single crawl initialisation (made only once a query isn't answered from
+ * the --db database, if any). Reports are written in input order and
+ * flushed as each one completes, so consumers can start on the first
+ * results while the rest of the batch is still running.
+ *
+ * Returns 0 if every query succeeded, 1 otherwise.
+ */
+static int run_batch(const char *filename)
+{
+  FILE *in = stdin;
+  if (strcmp(filename, "-"))
+  {
+    in = fopen(filename, "r");
+    if (!in)
+    {
+      perror(filename);
+      return 1;
+    }
+  }
+
+  if (qopts.format == REPORT_CSV)
+    fputs(report_csv_header(qopts.show_trials, show_partial()).c_str(),
+          stdout);
+
+  int status = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  std::string report;
+  while ((len = getline(&line, &line_size, in)) >= 0)
+  {
+    std::string query(line, len);
+    trim_string(query);
+    if (query.empty())
+      continue;
+
+    report.clear();
+    if (run_isolated_query(query, report))
+      status = 1;
+    fputs(report.c_str(), stdout);
+    fflush(stdout);
+  }
+  free(line);
+
+  if (in != stdin)
+    fclose(in);
+  return status;
+}
+
+// One record in a database dump: a monster type, or a vault monster name.
+struct dump_item
+{
+  monster_type type;
+  std::string vault_name;
+};
+
+// Skip the player ghost, placeholder entries without monster data of
+// their own, and monsters that aren't finished yet.
+static bool dumpable_monster_type(monster_type mt)
+{
+  if (mt == MONS_PLAYER_GHOST || mt == MONS_PROGRAM_BUG
+      || invalid_monster_type(mt))
+  {
+    return false;
+  }
+
+  const monsterentry *me = get_monster_data(mt);
+  return me && me->mc == mt && !mons_class_flag(mt, M_UNFINISHED);
+}
+
+static std::vector<dump_item> dump_items(bool include_vaults)
+{
+  std::vector<dump_item> items;
+  dump_item item;
+
+  for (int i = 0; i < NUM_MONSTERS; ++i)
+  {
+    item.type = static_cast<monster_type>(i);
+    if (dumpable_monster_type(item.type))
+      items.push_back(item);
+  }
+
+  if (include_vaults)
+  {
+    const vault_pack &pack = current_vault_pack();
+    item.type = MONS_NO_MONSTER;
+    for (int i = 0; i < pack.index_count(); ++i)
+    {
+      item.vault_name = pack.index_name(i);
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+static std::string dump_item_name(const dump_item &item)
+{
+  return item.vault_name.empty() ? mons_type_name(item.type, DESC_PLAIN)
+                                 : item.vault_name;
+}
+
+// Time each dump item may take, unless --deadline says otherwise. Items
+// that need longer are reported on fewer trials rather than killed, which
+// would take the rest of their dump worker's share with them.
+#define DUMP_ITEM_DEADLINE_MS 5000
+
+static int dump_item_query(const dump_item &item, std::string &report,
+                           monster_report *gathered)
+{
+  deadline_start(qopts.deadline_ms ? qopts.deadline_ms
+                                   : DUMP_ITEM_DEADLINE_MS);
+  const int status =
+    item.vault_name.empty()
+    ? describe_monster(mons_spec(item.type), dump_item_name(item), false,
+                       report, gathered)
+    : monster_query(item.vault_name, report, gathered);
+  sandbox_restore();
+  deadline_clear();
+  return status;
+}
+
+/**
+ * Run a query for one dump item and return its report, or report on
+ * stderr why it was skipped. Reports cut short by the deadline are kept,
+ * with a warning.
+ */
+static bool dump_item_report(const dump_item &item, std::string &report,
+                             monster_report *gathered = 0)
 {
-  std::stringstream ss;
-  ss << t;
-  return ss.str();
+  monster_report rep;
+  if (!gathered)
+    gathered = &rep;
+
+  if (dump_item_query(item, report, gathered) || report.empty())
+  {
+    fprintf(stderr, "Skipping %s: %s", dump_item_name(item).c_str(),
+            report.empty() ? "no report\n" : report.c_str());
+    return false;
+  }
+  if (gathered->partial)
+  {
+    fprintf(stderr, "%s: out of time after %d trials\n",
+            dump_item_name(item).c_str(), gathered->trials);
+  }
+  return true;
 }
 
+// Turn one item into a single-line record; false skips the item.
+typedef std::function<bool (const dump_item &item, std::string &record)>
+  dump_renderer;
+
+/**
+ * Render every item in forked workers: --jobs of them, or one per CPU by
+ * default. records[i] is set to the record for items[i], or left empty if
+ * the item was skipped.
+ */
+static bool render_dump_items(const std::vector<dump_item> &items,
+                              dump_renderer render,
+                              std::vector<std::string> &records)
+{
+  int workers = qopts.jobs;
+  if (workers <= 1)
+    workers = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+
+  std::vector<std::string> results;
+  const bool ok = run_forked_workers(workers,
+    [&](int worker, std::string &result)
+    {
+      // The dump is already parallel; don't fork again for each monster.
+      // This only changes the worker's copy of the options.
+      qopts.jobs = 1;
+      for (unsigned int i = worker; i < items.size(); i += workers)
+      {
+        std::string record;
+        if (render(items[i], record))
+          result += make_stringf("%u\t", i) + record + "\n";
+      }
+      return true;
+    },
+    results);
+
+  if (!ok)
+  {
+    fprintf(stderr, "A dump worker failed\n");
+    return false;
+  }
+
+  // Workers take every n-th item; put the records back in order.
+  records.assign(items.size(), std::string());
+  for (unsigned int w = 0; w < results.size(); ++w)
+  {
+    std::string::size_type pos = 0, eol;
+    while ((eol = results[w].find('\n', pos)) != std::string::npos)
+    {
+      const std::string line = results[w].substr(pos, eol - pos);
+      pos = eol + 1;
+
+      const std::string::size_type tab = line.find('\t');
+      const unsigned int i = atoi(line.c_str());
+      if (tab != std::string::npos && i < records.size())
+        records[i] = line.substr(tab + 1);
+    }
+  }
+  return true;
+}
+
+/**
+ * Write a report for every monster type (and, optionally, every indexed
+ * vault monster) to filename ("-" for stdout), one line per monster in
+ * monster type order.
+ *
+ * Monsters that can't be generated are reported on stderr and skipped.
+ * Returns 0 if the dump was written, 1 otherwise.
+ */
+static int dump_all(bool include_vaults, const char *filename)
+{
+  initialize_crawl();
+
+  std::vector<std::string> records;
+  const bool ok = render_dump_items(dump_items(include_vaults),
+    [](const dump_item &item, std::string &record)
+    {
+      if (!dump_item_report(item, record))
+        return false;
+      if (!record.empty() && record[record.size() - 1] == '\n')
+        record.erase(record.size() - 1);
+      return true;
+    },
+    records);
+  if (!ok)
+    return 1;
+
+  FILE *out = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+  if (!out)
+  {
+    perror(filename);
+    return 1;
+  }
+  if (qopts.format == REPORT_CSV)
+    fputs(report_csv_header(qopts.show_trials, show_partial()).c_str(),
+          out);
+  for (unsigned int i = 0; i < records.size(); ++i)
+    if (!records[i].empty())
+      fprintf(out, "%s\n", records[i].c_str());
+
+  const bool written = !ferror(out);
+  if (out != stdout)
+    fclose(out);
+  return written ? 0 : 1;
+}
+
+static std::string db_field(std::string field)
+{
+  if (!field.empty() && field[field.size() - 1] == '\n')
+    field.erase(field.size() - 1);
+  return replace_all_of(field, "\t\n", " ");
+}
+
+/**
+ * Write every monster type and indexed vault monster to a SQLite database
+ * for --db lookups, stamped with this crawl version and the trial settings.
+ *
+ * Text reports are stored with mIRC colour codes and recoloured when they
+ * are looked up. Returns 0 if the database was written, 1 otherwise.
+ */
+static int export_db(const char *filename)
+{
+  initialize_crawl();
+
+  qopts.format = REPORT_TEXT;
+  qopts.show_trials = false;
+  set_report_colour(COLOUR_IRC);
+
+  const std::vector<dump_item> items = dump_items(true);
+  std::vector<std::string> lines;
+  const bool ok = render_dump_items(items,
+    [](const dump_item &item, std::string &record)
+    {
+      std::string report;
+      monster_report rep;
+      if (!dump_item_report(item, report, &rep))
+        return false;
+
+      std::vector<std::string> fields = report_fields(rep, true, false);
+      fields.push_back(report);
+      fields.push_back(std::string());
+      emit_report(rep, REPORT_JSON, false, false, fields.back());
+      fields.push_back(std::string());
+      emit_report(rep, REPORT_CSV, false, false, fields.back());
+      for (unsigned int i = 0; i < fields.size(); ++i)
+      {
+        if (i)
+          record += "\t";
+        record += db_field(fields[i]);
+      }
+      return true;
+    },
+    lines);
+  if (!ok)
+    return 1;
+
+  const unsigned int ncolumns = report_columns(true, false).size();
+  std::vector<monster_db_record> records;
+  for (unsigned int i = 0; i < lines.size(); ++i)
+  {
+    if (lines[i].empty())
+      continue;
+
+    monster_db_record record;
+    record.fields = split_string("\t", lines[i], false, true);
+    if (record.fields.size() != ncolumns + 3)
+      continue;
+
+    record.csv = record.fields.back();
+    record.fields.pop_back();
+    record.json = record.fields.back();
+    record.fields.pop_back();
+    record.text = record.fields.back();
+    record.fields.pop_back();
+
+    record.vault = !items[i].vault_name.empty();
+    record.names.push_back(dump_item_name(items[i]));
+    record.names.push_back(record.fields[0]);
+    records.push_back(record);
+  }
+
+  return write_monster_db(filename, Version::Long, trial_settings(), records)
+         ? 0 : 1;
+}
+
+/**
+ * Write the stats of every monster type to a stat table for --table
+ * queries, stamped with this crawl version.
+ *
+ * Returns 0 if the table was written, 1 otherwise.
+ */
+static int export_table(const char *filename)
+{
+  initialize_crawl();
+
+  std::vector<std::string> rows;
+  const bool ok = render_dump_items(dump_items(false),
+    [](const dump_item &item, std::string &record)
+    {
+      std::string report;
+      monster_report rep;
+      if (!dump_item_report(item, report, &rep))
+        return false;
+      record = stat_table_row(rep);
+      return true;
+    },
+    rows);
+  if (!ok)
+    return 1;
+
+  stat_table table;
+  for (unsigned int i = 0; i < rows.size(); ++i)
+    if (!rows[i].empty() && !table.add_row(rows[i]))
+      fprintf(stderr, "Bad stat table row: %s\n", rows[i].c_str());
+
+  return table.write(filename, Version::Long) ? 0 : 1;
+}
+
+/**
+ * Answer a query over a whole stat table: the monsters matching where
+ * (every monster if empty), ranked by sort if given, at most top of them
+ * if top is non-zero. Needs no crawl initialisation.
+ */
+static int query_table(const char *filename, const std::string &where,
+                       const std::string &sort, unsigned int top)
+{
+  stat_table table;
+  if (!table.load(filename))
+  {
+    printf("Can't read stat table: %s\n", filename);
+    return 1;
+  }
+  if (table.version() != Version::Long)
+  {
+    fprintf(stderr, "Stat table is from %s, not %s\n",
+            table.version().c_str(), Version::Long);
+  }
+
+  std::string error;
+  std::vector<stat_predicate> predicates;
+  stat_order order;
+  if (!table.parse_where(where, predicates, error)
+      || !sort.empty() && !table.parse_order(sort, order, error))
+  {
+    printf("%s\n", error.c_str());
+    return 1;
+  }
+
+  TRACE_SPAN(span, "table_select");
+  std::vector<int> rows = table.select(predicates);
+  if (!sort.empty())
+    table.rank(rows, order, top);
+  else if (top && top < rows.size())
+    rows.resize(top);
+  TRACE_END(span);
+
+  if (rows.empty())
+    printf("No monsters match.\n");
+  for (unsigned int i = 0; i < rows.size(); ++i)
+  {
+    if (sort.empty() || !order.ratio)
+      printf("%s\n", table.describe(rows[i]).c_str());
+    else
+    {
+      printf("%s | %s: %.2f\n", table.describe(rows[i]).c_str(),
+             order.name.c_str(), table.order_value(rows[i], order));
+    }
+  }
+  return 0;
+}
+
+/**
+ * Hash the static data of a monster type: its whole monsterentry (with
+ * the name hashed by value rather than address) and its spellbook.
+ * Monsters choosing between several books are keyed by their default one.
+ */
+static uint64_t monster_type_fingerprint(monster_type mt)
+{
+  uint64_t hash = FNV1A_OFFSET_BASIS;
+  const monsterentry *me = get_monster_data(mt);
+  if (!me)
+    return hash;
+
+  char entry[sizeof(monsterentry)];
+  memcpy(entry, me, sizeof entry);
+  memset(entry + offsetof(monsterentry, name), 0, sizeof me->name);
+  hash = fnv1a_hash(entry, sizeof entry, hash);
+  hash = fnv1a_hash(me->name, strlen(me->name), hash);
+
+  for (unsigned int i = 0; i < ARRAYSZ(mspell_list); ++i)
+  {
+    if (mspell_list[i].type != me->sec)
+      continue;
+    for (unsigned int j = 0; j < mspell_list[i].spells.size(); ++j)
+    {
+      const mon_spell_slot &slot = mspell_list[i].spells[j];
+      hash = fnv1a_hash(&slot.spell, sizeof slot.spell, hash);
+      hash = fnv1a_hash(&slot.freq, sizeof slot.freq, hash);
+      hash = fnv1a_hash(&slot.flags, sizeof slot.flags, hash);
+    }
+  }
+  return hash;
+}
+
+// A vault monster depends on its spec as well as its monster type.
+static uint64_t dump_item_fingerprint(const dump_item &item)
+{
+  if (item.vault_name.empty())
+    return monster_type_fingerprint(item.type);
+
+  std::string spec_text;
+  const mons_spec spec = get_vault_monster(item.vault_name, &spec_text);
+  uint64_t hash = monster_type_fingerprint(spec.type);
+  hash = fnv1a_hash(spec_text.data(), spec_text.size(), hash);
+  if (spec.monbase != MONS_NO_MONSTER)
+  {
+    const uint64_t base = monster_type_fingerprint(spec.monbase);
+    hash = fnv1a_hash(&base, sizeof base, hash);
+  }
+  return hash;
+}
+
+/**
+ * Sample the given dump items into snapshot, one entry each. Items that
+ * can't be generated are reported on stderr and left out.
+ */
+static bool snapshot_items(const std::vector<dump_item> &items,
+                           report_snapshot &snapshot)
+{
+  std::vector<std::string> lines;
+  const bool ok = render_dump_items(items,
+    [](const dump_item &item, std::string &record)
+    {
+      std::string report;
+      monster_report rep;
+      if (!dump_item_report(item, report, &rep))
+        return false;
+
+      const std::vector<std::string> fields = report_fields(rep, false, false);
+      for (unsigned int i = 0; i < fields.size(); ++i)
+      {
+        if (i)
+          record += "\t";
+        record += db_field(fields[i]);
+      }
+      return true;
+    },
+    lines);
+  if (!ok)
+    return false;
+
+  for (unsigned int i = 0; i < lines.size(); ++i)
+  {
+    if (lines[i].empty())
+      continue;
+
+    snapshot_entry entry;
+    entry.key = dump_item_name(items[i]);
+    entry.fingerprint = dump_item_fingerprint(items[i]);
+    entry.fields = split_string("\t", lines[i], false, true);
+    snapshot.add(entry);
+  }
+  return true;
+}
+
+static void start_snapshot(report_snapshot &snapshot)
+{
+  snapshot.version = Version::Long;
+  snapshot.settings = trial_settings();
+  const std::vector<report_column> columns = report_columns(false, false);
+  for (unsigned int i = 0; i < columns.size(); ++i)
+    snapshot.columns.push_back(columns[i].name);
+}
+
+/**
+ * Save the report of every monster type and indexed vault monster to a
+ * snapshot, for comparing later builds against with --diff-snapshot.
+ *
+ * Returns 0 if the snapshot was written, 1 otherwise.
+ */
+static int save_snapshot(const char *filename)
+{
+  initialize_crawl();
+
+  report_snapshot snapshot;
+  start_snapshot(snapshot);
+  if (!snapshot_items(dump_items(true), snapshot))
+    return 1;
+  return snapshot.write(filename) ? 0 : 1;
+}
+
+/**
+ * Compare this build against a saved snapshot, printing one line per
+ * monster added, removed or changed. Only monsters whose fingerprint
+ * differs from the snapshot's are sampled again, unless full is set (to
+ * catch changes in code rather than data) or the snapshot was sampled with
+ * other settings. If save_as isn't empty, the current reports are saved
+ * there as a new snapshot.
+ *
+ * Returns 0 if there were no changes, 2 if there were and 1 on error.
+ */
+static int diff_snapshot(const char *filename, bool full,
+                         const std::string &save_as)
+{
+  report_snapshot before;
+  if (!before.load(filename))
+  {
+    printf("Can't read snapshot: %s\n", filename);
+    return 1;
+  }
+
+  initialize_crawl();
+
+  report_snapshot after;
+  start_snapshot(after);
+  if (before.settings != after.settings || before.columns != after.columns)
+  {
+    fprintf(stderr, "Snapshot was taken with other settings; sampling"
+            " every monster\n");
+    full = true;
+  }
+
+  const std::vector<dump_item> items = dump_items(true);
+  std::vector<dump_item> changed;
+  std::vector<bool> resample(items.size());
+  for (unsigned int i = 0; i < items.size(); ++i)
+  {
+    const snapshot_entry *old = before.find(dump_item_name(items[i]));
+    resample[i] = full || !old
+                  || old->fingerprint != dump_item_fingerprint(items[i]);
+    if (resample[i])
+      changed.push_back(items[i]);
+  }
+  fprintf(stderr, "Sampling %u of %u monsters\n",
+          (unsigned int) changed.size(), (unsigned int) items.size());
+
+  report_snapshot sampled;
+  if (!snapshot_items(changed, sampled))
+    return 1;
+
+  // Keep the snapshot in monster order, taking unchanged monsters from the
+  // old one.
+  for (unsigned int i = 0; i < items.size(); ++i)
+  {
+    const std::string name = dump_item_name(items[i]);
+    const snapshot_entry *entry = resample[i] ? sampled.find(name)
+                                              : before.find(name);
+    if (entry)
+      after.add(*entry);
+  }
+
+  const std::vector<snapshot_change> changes = diff_snapshots(before, after);
+  for (unsigned int i = 0; i < changes.size(); ++i)
+    printf("%s\n", format_snapshot_change(changes[i]).c_str());
+  if (changes.empty())
+    printf("No changes since %s\n", before.version.c_str());
+
+  if (!save_as.empty() && !after.write(save_as))
+    return 1;
+  return changes.empty() ? 0 : 2;
+}
+
+/**
+ * Extract the vault monster specs from the .des files under des_folder and
+ * write them to the vault pack, with its name index. If no .des file has
+ * changed since the last scan and the pack is indexed for this version,
+ * the pack is left as it is.
+ */
+static int scan_vaults(const std::string &des_folder,
+                       const std::string &pack_path)
+{
+  des_scanner scanner(pack_path + ".cache");
+  if (!scanner.scan(des_folder, std::thread::hardware_concurrency()))
+  {
+    fprintf(stderr, "No .des files in %s\n", des_folder.c_str());
+    return 1;
+  }
+  printf("Scanned %d .des files (%d changed), %u vault monsters\n",
+         scanner.files_scanned(), scanner.files_parsed(),
+         (unsigned int) scanner.specs().size());
+
+  vault_pack old_pack;
+  if (!scanner.changed() && old_pack.load(pack_path)
+      && old_pack.index_count() > 0
+      && !strcmp(old_pack.version(), Version::Long))
+  {
+    printf("%s is up to date\n", pack_path.c_str());
+    return 0;
+  }
+  old_pack.unload();
+
+  if (!write_vault_pack(pack_path, scanner.specs(),
+                        std::vector<std::pair<std::string, int> >(),
+                        std::vector<std::string>(), Version::Long))
+  {
+    return 1;
+  }
+
+  initialize_crawl();
+  if (!write_vault_monster_index(pack_path))
+    return 1;
+  return scanner.save_cache() ? 0 : 1;
+}
+
+// Match both the -option and --option spellings.
+static bool is_option(const char *arg, const char *name)
+{
+  return arg[0] == '-'
+         && (!strcmp(arg + 1, name) || arg[1] == '-' && !strcmp(arg + 2, name));
+}
+
+/**
+ * Parse the query options at argv[arg] onwards into qopts.
+ *
+ * Returns the index of the first argument that isn't a query option, or -1
+ * after printing an error if an option is malformed.
+ */
+static int parse_query_options(int argc, char *argv[], int arg)
+{
+  while (arg < argc)
+  {
+    if (is_option(argv[arg], "jobs") || !strcmp(argv[arg], "-j"))
+    {
+      if (arg + 1 >= argc || (qopts.jobs = atoi(argv[arg + 1])) < 1)
+      {
+        printf("%s needs a positive number of jobs\n", argv[arg]);
+        return -1;
+      }
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "min-trials")
+             || is_option(argv[arg], "max-trials")
+             || is_option(argv[arg], "novelty"))
+    {
+      const int value = arg + 1 < argc ? atoi(argv[arg + 1]) : 0;
+      if (value < 1)
+      {
+        printf("%s needs a positive number of trials\n", argv[arg]);
+        return -1;
+      }
+      if (is_option(argv[arg], "min-trials"))
+        qopts.min_trials = value;
+      else if (is_option(argv[arg], "max-trials"))
+        qopts.max_trials = value;
+      else
+        qopts.novelty_trials = value;
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "confidence"))
+    {
+      if (arg + 1 >= argc || (qopts.confidence = atof(argv[arg + 1])) <= 0)
+      {
+        printf("%s needs a positive fraction\n", argv[arg]);
+        return -1;
+      }
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "deadline"))
+    {
+      if (arg + 1 >= argc || (qopts.deadline_ms = atoi(argv[arg + 1])) < 1)
+      {
+        printf("%s needs a positive number of milliseconds\n", argv[arg]);
+        return -1;
+      }
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "show-trials"))
+    {
+      qopts.show_trials = true;
+      ++arg;
+    }
+    else if (is_option(argv[arg], "dist"))
+    {
+      qopts.distributions = true;
+      ++arg;
+    }
+    else if (is_option(argv[arg], "items"))
+    {
+      qopts.items = true;
+      ++arg;
+    }
+    else if (is_option(argv[arg], "db"))
+    {
+      if (arg + 1 >= argc)
+      {
+        printf("%s needs a database file\n", argv[arg]);
+        return -1;
+      }
+      qopts.db_path = argv[arg + 1];
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "cache"))
+    {
+      if (arg + 1 >= argc)
+      {
+        printf("%s needs a cache file\n", argv[arg]);
+        return -1;
+      }
+      qopts.cache_path = argv[arg + 1];
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "trace"))
+    {
+      if (arg + 1 >= argc)
+      {
+        printf("%s needs a trace file\n", argv[arg]);
+        return -1;
+      }
+#ifdef MONSTER_TRACE
+      if (!trace_open(argv[arg + 1]))
+      {
+        printf("Can't write trace to %s: %s\n", argv[arg + 1],
+               strerror(errno));
+        return -1;
+      }
+#else
+      printf("%s needs a build with tracing: make TRACE=y\n", argv[arg]);
+      return -1;
+#endif
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "colour") || is_option(argv[arg], "color"))
+    {
+      if (arg + 1 >= argc
+          || !parse_colour_backend(argv[arg + 1], qopts.colours))
+      {
+        printf("%s needs one of auto, irc, ansi, html or plain\n", argv[arg]);
+        return -1;
+      }
+      arg += 2;
+    }
+    else if (is_option(argv[arg], "format"))
+    {
+      if (arg + 1 >= argc
+          || !parse_report_format(argv[arg + 1], qopts.format))
+      {
+        printf("%s needs one of text, json or csv\n", argv[arg]);
+        return -1;
+      }
+      arg += 2;
+    }
+    else
+      break;
+  }
+  return arg;
+}
+
+#ifndef MONSTER_NO_MAIN
+int main(int argc, char *argv[])
+{
+  alarm(5);
+  crawl_state.test = true;
+
+  const int arg = parse_query_options(argc, argv, 1);
+  if (arg < 0)
+    return 1;
+
+  if (qopts.max_trials < qopts.min_trials)
+  {
+    printf("--max-trials must be at least --min-trials\n");
+    return 1;
+  }
+
+  set_report_colour(qopts.format == REPORT_TEXT ? qopts.colours
+                                                : COLOUR_NONE);
+
+  if (arg >= argc)
+  {
+    printf("Usage: @? [--jobs N] [--min-trials N] [--max-trials N]"
+           " [--novelty N] [--confidence F] [--deadline MS] [--show-trials]"
+           " [--dist] [--items]"
+           " [--format text|json|csv] [--colour auto|irc|ansi|html|plain]"
+           " [--db FILE] [--cache FILE] [--trace FILE] <monster name>\n");
+    return 0;
+  }
+
+  const int nargs = argc - arg;
+
+  if (is_option(argv[arg], "version"))
+  {
+    printf("Monster stats Crawl version: %s\n", Version::Long);
+    const vault_pack &pack = current_vault_pack();
+    if (pack.loaded())
+      printf("Vault monster pack version: %s\n", pack.version());
+    return 0;
+  }
+  else if (is_option(argv[arg], "name"))
+  {
+    seed_rng();
+    printf("%s\n", make_name().c_str());
+    return 0;
+  }
+  else if (is_option(argv[arg], "serve"))
+  {
+    if (nargs != 2)
+    {
+      printf("Usage: %s --serve <socket path>\n", argv[0]);
+      printf("Queries from all clients are answered one at a time, so a"
+             " slow query delays\nevery request queued behind it, for up to"
+             " its --deadline or alarm.\n");
+      return 1;
+    }
+    // The server runs until killed; individual queries are still guarded
+    // by their own alarm.
+    alarm(0);
+    initialize_crawl();
+    return serve_queries(argv[arg + 1], run_isolated_query);
+  }
+  else if (is_option(argv[arg], "vault-index"))
+  {
+    if (nargs != 2)
+    {
+      printf("Usage: %s --vault-index <vault pack>\n", argv[0]);
+      return 1;
+    }
+    // Places every vault monster once; this takes a while.
+    alarm(0);
+    initialize_crawl();
+    return write_vault_monster_index(argv[arg + 1]) ? 0 : 1;
+  }
+  else if (is_option(argv[arg], "dump-all"))
+  {
+    int next = arg + 1;
+    const bool include_vaults = next < argc && is_option(argv[next], "vaults");
+    if (include_vaults)
+      ++next;
+    if (argc - next > 1)
+    {
+      printf("Usage: %s --dump-all [--vaults] [file|-]\n", argv[0]);
+      return 1;
+    }
+    alarm(0);
+    return dump_all(include_vaults, next < argc ? argv[next] : "-");
+  }
+  else if (is_option(argv[arg], "complete"))
+  {
+    if (nargs < 2)
+    {
+      printf("Usage: %s --complete <prefix>\n", argv[0]);
+      return 1;
+    }
+    std::string prefix = argv[arg + 1];
+    for (int x = arg + 2; x < argc; x++)
+      prefix += std::string(" ") + argv[x];
+
+    // Not a query: without an indexed vault pack this initialises crawl.
+    alarm(0);
+    const std::vector<std::string> names =
+      monster_name_index().complete(prefix, MAX_COMPLETIONS);
+    for (unsigned int i = 0; i < names.size(); ++i)
+      printf("%s\n", names[i].c_str());
+    return 0;
+  }
+  else if (is_option(argv[arg], "scan-des"))
+  {
+    if (nargs != 3)
+    {
+      printf("Usage: %s --scan-des <des folder> <vault pack>\n", argv[0]);
+      return 1;
+    }
+    alarm(0);
+    return scan_vaults(argv[arg + 1], argv[arg + 2]);
+  }
+  else if (is_option(argv[arg], "tile-info"))
+  {
+    if (nargs < 2 || nargs > 3)
+    {
+      printf("Usage: %s --tile-info <dc-mon.txt> [file]\n", argv[0]);
+      return 1;
+    }
+    alarm(0);
+    initialize_crawl();
+    return write_vault_tile_info(argv[arg + 1],
+                                 nargs == 3 ? argv[arg + 2]
+                                            : "tile_info.txt") ? 0 : 1;
+  }
+  else if (is_option(argv[arg], "tile"))
+  {
+    if (nargs < 2)
+    {
+      printf("Usage: %s --tile <monster name>\n", argv[0]);
+      return 1;
+    }
+    std::string name = argv[arg + 1];
+    for (int x = arg + 2; x < argc; x++)
+      name += std::string(" ") + argv[x];
+
+    const std::string tile = find_vault_tile(name);
+    if (tile.empty())
+    {
+      printf("No vault tile for: %s\n", name.c_str());
+      return 1;
+    }
+    printf("%s\n", tile.c_str());
+    return 0;
+  }
+  else if (is_option(argv[arg], "export-db"))
+  {
+    if (nargs != 2)
+    {
+      printf("Usage: %s --export-db <file>\n", argv[0]);
+      return 1;
+    }
+    alarm(0);
+    return export_db(argv[arg + 1]);
+  }
+  else if (is_option(argv[arg], "export-table"))
+  {
+    if (nargs != 2)
+    {
+      printf("Usage: %s --export-table <file>\n", argv[0]);
+      return 1;
+    }
+    alarm(0);
+    return export_table(argv[arg + 1]);
+  }
+  else if (is_option(argv[arg], "snapshot"))
+  {
+    if (nargs != 2)
+    {
+      printf("Usage: %s --snapshot <file>\n", argv[0]);
+      return 1;
+    }
+    alarm(0);
+    return save_snapshot(argv[arg + 1]);
+  }
+  else if (is_option(argv[arg], "diff-snapshot"))
+  {
+    bool full = false;
+    std::string save_as;
+    bool usage = nargs < 2;
+    for (int x = arg + 2; x < argc && !usage; ++x)
+    {
+      if (is_option(argv[x], "full"))
+        full = true;
+      else if (is_option(argv[x], "save") && x + 1 < argc)
+        save_as = argv[++x];
+      else
+        usage = true;
+    }
+    if (usage)
+    {
+      printf("Usage: %s --diff-snapshot <file> [--full] [--save FILE]\n",
+             argv[0]);
+      return 1;
+    }
+    alarm(0);
+    return diff_snapshot(argv[arg + 1], full, save_as);
+  }
+  else if (is_option(argv[arg], "table"))
+  {
+    std::string where, sort;
+    int top = 0;
+    bool usage = nargs < 2;
+    for (int x = arg + 2; x < argc && !usage; x += 2)
+    {
+      if (x + 1 >= argc)
+        usage = true;
+      else if (is_option(argv[x], "where"))
+        where = argv[x + 1];
+      else if (is_option(argv[x], "sort"))
+        sort = argv[x + 1];
+      else if (is_option(argv[x], "top"))
+        usage = (top = atoi(argv[x + 1])) <= 0;
+      else
+        usage = true;
+    }
+    if (usage)
+    {
+      printf("Usage: %s --table <file> [--where EXPR] [--sort KEY]"
+             " [--top N]\n", argv[0]);
+      return 1;
+    }
+    return query_table(argv[arg + 1], where, sort, top);
+  }
+  else if (is_option(argv[arg], "batch"))
+  {
+    if (nargs > 2)
+    {
+      printf("Usage: %s --batch [file|-]\n", argv[0]);
+      return 1;
+    }
+    alarm(0);
+    return run_batch(nargs == 2 ? argv[arg + 1] : "-");
+  }
+
+  std::string target = argv[arg];
+  for (int x = arg + 1; x < argc; x++)
+  {
+    target.append(" ");
+    target.append(argv[x]);
+  }
+
+  std::string report;
+  int status = 0;
+  if (!cached_query(target, report) && !db_query(target, report))
+  {
+    deadline_start(qopts.deadline_ms);
+    alarm(query_alarm_seconds());
+    status = live_query(target, report);
+  }
+  if (qopts.format == REPORT_CSV)
+    fputs(report_csv_header(qopts.show_trials, show_partial()).c_str(),
+          stdout);
+  fputs(report.c_str(), stdout);
+  return status;
+}
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 // acr.cc stuff
 
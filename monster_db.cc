@@ -0,0 +1,300 @@
+/**
+ * @file monster_db.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Write and read the monster database: one row per monster with the
+ * report_columns() stats as columns, the rendered reports, and a table of
+ * lookup names. The database is stamped with the crawl version and the
+ * sampling settings it was generated with, so that a stale database, or
+ * one that doesn't match the settings of a query, can be detected and
+ * ignored.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "file_util.h"
+#include "monster_db.h"
+#include "stringutil.h"
+
+#include <sqlite3.h>
+#include <unistd.h>
+
+/**
+ * Normalise a monster name for lookup: case, surrounding space, a leading
+ * "the" and apostrophes don't matter.
+**/
+std::string monster_db_key(std::string name)
+{
+    trim_string(name);
+    lowercase(name);
+    name = replace_all_of(name, "'", "");
+    if (name.find("the ") == 0)
+    {
+        name.erase(0, 4);
+        trim_string(name);
+    }
+    return name;
+}
+
+static bool exec_sql(sqlite3 *db, const std::string &sql)
+{
+    char *err = 0;
+    if (sqlite3_exec(db, sql.c_str(), 0, 0, &err) != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", err ? err : sqlite3_errmsg(db));
+        sqlite3_free(err);
+        return false;
+    }
+    return true;
+}
+
+static sqlite3_stmt *prepare_sql(sqlite3 *db, const std::string &sql)
+{
+    sqlite3_stmt *stmt = 0;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+    return stmt;
+}
+
+static void bind_text(sqlite3_stmt *stmt, int column, const std::string &text)
+{
+    sqlite3_bind_text(stmt, column, text.c_str(), text.size(),
+                      SQLITE_TRANSIENT);
+}
+
+static bool insert_meta(sqlite3 *db, const char *key,
+                        const std::string &value)
+{
+    sqlite3_stmt *meta = prepare_sql(db, "INSERT INTO meta VALUES (?, ?)");
+    if (!meta)
+        return false;
+    sqlite3_bind_text(meta, 1, key, -1, SQLITE_STATIC);
+    bind_text(meta, 2, value);
+    const bool ok = sqlite3_step(meta) == SQLITE_DONE;
+    sqlite3_finalize(meta);
+    return ok;
+}
+
+static std::string read_meta(sqlite3 *db, const char *key)
+{
+    std::string value;
+    sqlite3_stmt *meta =
+        prepare_sql(db, "SELECT value FROM meta WHERE key = ?");
+    if (!meta)
+        return value;
+    sqlite3_bind_text(meta, 1, key, -1, SQLITE_STATIC);
+    if (sqlite3_step(meta) == SQLITE_ROW)
+    {
+        const unsigned char *text = sqlite3_column_text(meta, 0);
+        if (text)
+            value = reinterpret_cast<const char *>(text);
+    }
+    sqlite3_finalize(meta);
+    return value;
+}
+
+static bool insert_records(sqlite3 *db, const std::string &version,
+                           const std::string &settings,
+                           const std::vector<monster_db_record> &records)
+{
+    const std::vector<report_column> columns = report_columns(true, false);
+
+    std::string create = "CREATE TABLE monsters (id INTEGER PRIMARY KEY,"
+                         " vault INTEGER NOT NULL";
+    std::string insert = "INSERT INTO monsters VALUES (?, ?";
+    for (unsigned int i = 0; i < columns.size(); ++i)
+    {
+        create += make_stringf(", %s %s", columns[i].name,
+                               columns[i].numeric ? "INTEGER" : "TEXT");
+        insert += ", ?";
+    }
+    create += ", text TEXT, json TEXT, csv TEXT)";
+    insert += ", ?, ?, ?)";
+
+    if (!exec_sql(db, "CREATE TABLE meta (key TEXT PRIMARY KEY, value TEXT)")
+        || !exec_sql(db, create)
+        || !exec_sql(db, "CREATE TABLE names (key TEXT PRIMARY KEY,"
+                         " monster INTEGER NOT NULL REFERENCES monsters(id))"))
+    {
+        return false;
+    }
+
+    if (!insert_meta(db, "version", version)
+        || !insert_meta(db, "settings", settings))
+    {
+        return false;
+    }
+
+    sqlite3_stmt *monster = prepare_sql(db, insert);
+    sqlite3_stmt *name =
+        prepare_sql(db, "INSERT OR IGNORE INTO names VALUES (?, ?)");
+    bool ok = monster && name;
+
+    for (unsigned int i = 0; ok && i < records.size(); ++i)
+    {
+        const monster_db_record &record = records[i];
+        if (record.fields.size() != columns.size())
+            continue;
+
+        int col = 1;
+        sqlite3_bind_int(monster, col++, i);
+        sqlite3_bind_int(monster, col++, record.vault);
+        for (unsigned int j = 0; j < columns.size(); ++j, ++col)
+        {
+            if (columns[j].numeric)
+                sqlite3_bind_int64(monster, col, atoll(record.fields[j].c_str()));
+            else
+                bind_text(monster, col, record.fields[j]);
+        }
+        bind_text(monster, col++, record.text);
+        bind_text(monster, col++, record.json);
+        bind_text(monster, col++, record.csv);
+        ok = sqlite3_step(monster) == SQLITE_DONE;
+        sqlite3_reset(monster);
+
+        for (unsigned int j = 0; ok && j < record.names.size(); ++j)
+        {
+            bind_text(name, 1, monster_db_key(record.names[j]));
+            sqlite3_bind_int(name, 2, i);
+            ok = sqlite3_step(name) == SQLITE_DONE;
+            sqlite3_reset(name);
+        }
+    }
+    if (!ok)
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+
+    sqlite3_finalize(monster);
+    sqlite3_finalize(name);
+
+    return ok
+           && exec_sql(db, "CREATE INDEX monsters_name ON monsters (name)")
+           && exec_sql(db, "CREATE INDEX monsters_hd ON monsters (hd)")
+           && exec_sql(db, "CREATE INDEX monsters_xp ON monsters (xp)");
+}
+
+/**
+ * Write a monster database. The file is built under a temporary name and
+ * renamed into place, so readers never see a partial database.
+ *
+ * @param filename The database to write.
+ * @param version  The crawl version the records were computed with.
+ * @param settings The sampling settings the records were computed with.
+ * @param records  The monsters, in the order they should be numbered.
+ * @return Whether the database was written.
+**/
+bool write_monster_db(const std::string &filename, const std::string &version,
+                      const std::string &settings,
+                      const std::vector<monster_db_record> &records)
+{
+    const std::string tmp = temp_file_path(filename);
+    unlink(tmp.c_str());
+
+    sqlite3 *db = 0;
+    if (sqlite3_open(tmp.c_str(), &db) != SQLITE_OK)
+    {
+        fprintf(stderr, "Can't create %s: %s\n", tmp.c_str(),
+                db ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        return false;
+    }
+
+    const bool ok = exec_sql(db, "PRAGMA journal_mode = OFF")
+                    && exec_sql(db, "PRAGMA synchronous = OFF")
+                    && exec_sql(db, "BEGIN")
+                    && insert_records(db, version, settings, records)
+                    && exec_sql(db, "COMMIT");
+    const bool closed = sqlite3_close(db) == SQLITE_OK;
+
+    if (!ok || !closed)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return replace_with_temp_file(tmp, filename);
+}
+
+monster_db::monster_db() : db(0), find(0)
+{
+}
+
+monster_db::~monster_db()
+{
+    close();
+}
+
+/**
+ * Open a database read-only and read its version and settings.
+ *
+ * @return Whether the file is a readable monster database.
+**/
+bool monster_db::open(const std::string &filename)
+{
+    close();
+
+    if (sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READONLY, 0)
+        != SQLITE_OK)
+    {
+        close();
+        return false;
+    }
+
+    db_version = read_meta(db, "version");
+    db_settings = read_meta(db, "settings");
+
+    find = prepare_sql(db, "SELECT m.text, m.json, m.csv FROM names n"
+                           " JOIN monsters m ON m.id = n.monster"
+                           " WHERE n.key = ?");
+    if (!find || db_version.empty())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void monster_db::close()
+{
+    sqlite3_finalize(find);
+    find = 0;
+    sqlite3_close(db);
+    db = 0;
+    db_version.clear();
+    db_settings.clear();
+}
+
+/**
+ * Look up a stored report.
+ *
+ * @param name   The monster name as queried.
+ * @param format The report format wanted.
+ * @param report Set to the report, with a trailing newline, if found. Text
+ *               reports are recoloured for the current colour backend.
+ * @return Whether the name was found.
+**/
+bool monster_db::lookup(const std::string &name, report_format format,
+                        std::string &report)
+{
+    if (!find)
+        return false;
+
+    bind_text(find, 1, monster_db_key(name));
+    const bool found = sqlite3_step(find) == SQLITE_ROW;
+    if (found)
+    {
+        const int column = format == REPORT_JSON ? 1
+                           : format == REPORT_CSV ? 2
+                           : 0;
+        const unsigned char *text = sqlite3_column_text(find, column);
+        const std::string stored = text ? reinterpret_cast<const char *>(text)
+                                        : "";
+        report = (format == REPORT_TEXT ? recolour_report(stored) : stored)
+                 + "\n";
+    }
+    sqlite3_reset(find);
+    return found;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file monster_db.h
+ *
+ * @section DESCRIPTION
+ *
+ * A SQLite export of every monster's report, so that lookups can be
+ * answered without initialising crawl.
+ *
+**/
+
+#ifndef __MONSTER_DB_H__
+#define __MONSTER_DB_H__
+
+#include "AppHdr.h"
+
+#include "monster_report.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// One exported monster.
+struct monster_db_record
+{
+    // Names the monster can be looked up by; the first is its own name.
+    std::vector<std::string> names;
+    bool vault;
+    // One value per report_columns(true) column.
+    std::vector<std::string> fields;
+    // The text report (with mIRC colour codes), JSON and CSV row, without
+    // trailing newlines.
+    std::string text;
+    std::string json;
+    std::string csv;
+
+    monster_db_record() : vault(false) { }
+};
+
+bool write_monster_db(const std::string &filename, const std::string &version,
+                      const std::string &settings,
+                      const std::vector<monster_db_record> &records);
+
+std::string monster_db_key(std::string name);
+
+class monster_db
+{
+public:
+    monster_db();
+    ~monster_db();
+
+    bool open(const std::string &filename);
+    void close();
+
+    // The crawl version the database was exported from.
+    const std::string &version() const { return db_version; }
+    // The sampling settings the reports were computed with; empty for a
+    // database that didn't record them.
+    const std::string &settings() const { return db_settings; }
+
+    bool lookup(const std::string &name, report_format format,
+                std::string &report);
+
+private:
+    sqlite3 *db;
+    sqlite3_stmt *find;
+    std::string db_version;
+    std::string db_settings;
+
+    monster_db(const monster_db &);
+    monster_db &operator = (const monster_db &);
+};
+
+#endif
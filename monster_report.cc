@@ -0,0 +1,681 @@
+/**
+ * @file monster_report.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Turn a gathered monster_report into text, JSON or CSV. The text form is
+ * the traditional one-line report, coloured by the current colour backend
+ * (see report_builder.h).
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "colour.h"
+#include "monster_report.h"
+#include "stringutil.h"
+
+#include <algorithm>
+
+bool parse_report_format(const std::string &name, report_format &format)
+{
+    if (name == "text")
+        format = REPORT_TEXT;
+    else if (name == "json")
+        format = REPORT_JSON;
+    else if (name == "csv")
+        format = REPORT_CSV;
+    else
+        return false;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Text
+
+static void text_tokens(report_builder &b,
+                        const std::vector<report_token> &tokens,
+                        const char *sep)
+{
+    for (unsigned int i = 0; i < tokens.size(); ++i)
+    {
+        if (i)
+            b.text(sep);
+        b.coloured(tokens[i].colour, tokens[i].text);
+    }
+}
+
+static void text_speed(report_builder &b, const monster_report &report)
+{
+    if (report.speed_max != report.speed_min)
+        b.number(report.speed_min).text("-").number(report.speed_max);
+    else if (report.speed_max == 0)
+        b.coloured(BROWN, "0");
+    else
+        b.number(report.speed_max);
+
+    if (report.energy.empty() && !report.stationary)
+        return;
+
+    b.text(" (");
+    for (unsigned int i = 0; i < report.energy.size(); ++i)
+    {
+        if (i)
+            b.text("; ");
+        b.text(report.energy[i].first).text(": ")
+         .number(report.energy[i].second).text("%");
+    }
+    if (report.stationary)
+    {
+        if (!report.energy.empty())
+            b.text("; ");
+        b.coloured(BROWN, "stationary");
+    }
+    b.text(")");
+}
+
+static void text_attack(report_builder &b, const report_attack &attack)
+{
+    b.number(attack.damage);
+    text_tokens(b, attack.flavours, "");
+    if (attack.per_head)
+        b.text(" per head");
+}
+
+static void text_resist(report_builder &b, const report_resist &resist)
+{
+    int col = resist.colour;
+    if (!resist.detail.empty())
+    {
+        b.begin_colour(col).text(resist.name).text("(").text(resist.detail)
+         .text(")").end_colour(col);
+        return;
+    }
+
+    const bool vul = resist.level < 0;
+    const int rval = vul ? -resist.level : resist.level;
+    if (col && (rval == 3 || rval == 1 && col == BROWN || vul) && col <= 7)
+        col += 8;
+
+    b.begin_colour(col).text(resist.name);
+    if (rval > 1 && rval <= 3)
+        b.repeat('+', rval);
+    b.end_colour(col);
+}
+
+static void text_resists(report_builder &b, const monster_report &report,
+                         bool vul)
+{
+    bool first = true;
+    for (unsigned int i = 0; i < report.resists.size(); ++i)
+    {
+        const report_resist &resist = report.resists[i];
+        if (vul != (resist.level < 0))
+            continue;
+        b.text(first ? (vul ? " | Vul: " : " | Res: ") : ", ");
+        first = false;
+        text_resist(b, resist);
+    }
+}
+
+static void text_spell(report_builder &b, const report_spell &spell)
+{
+    if (!spell.heads.empty())
+    {
+        b.text("{");
+        for (unsigned int i = 0; i < spell.heads.size(); ++i)
+        {
+            b.text(make_stringf("%shead %d: ", i ? ", " : "", i + 1))
+             .text(spell.heads[i].first).text(" (")
+             .text(spell.heads[i].second).text(")");
+        }
+        b.text("}");
+    }
+    else
+    {
+        b.text(spell.name);
+        for (unsigned int i = 0; i < spell.damages.size(); ++i)
+            b.text(i ? " / " : " (").text(spell.damages[i]);
+        if (!spell.damages.empty())
+            b.text(")");
+    }
+
+    if (!spell.flags.empty())
+    {
+        b.text(" [");
+        text_tokens(b, spell.flags, ", ");
+        b.text("]");
+    }
+}
+
+/**
+ * The spell sets, rendered for the given colour backend and sorted: each
+ * a comma-separated list of spells, the sets separated by slashes.
+**/
+static std::string text_spells(const monster_report &report,
+                               colour_backend backend)
+{
+    std::string out;
+    if (report.random_spells)
+    {
+        report_builder(out, backend).text("(random)");
+        return out;
+    }
+
+    std::vector<std::string> sets;
+    for (unsigned int i = 0; i < report.spell_sets.size(); ++i)
+    {
+        std::string set;
+        report_builder b(set, backend);
+        for (unsigned int j = 0; j < report.spell_sets[i].size(); ++j)
+        {
+            if (j)
+                b.text(", ");
+            text_spell(b, report.spell_sets[i][j]);
+        }
+        sets.push_back(set);
+    }
+    std::sort(sets.begin(), sets.end());
+
+    for (unsigned int i = 0; i < sets.size(); ++i)
+        out += (i ? " / " : "") + sets[i];
+    return out;
+}
+
+static void emit_text(const monster_report &report, bool show_trials,
+                      std::string &out)
+{
+    report_builder b(out, current_colour_backend());
+
+    b.text(report.name).text(" (")
+     .coloured(report.glyph.colour, report.glyph.text).text(")");
+
+    if (report.unfinished)
+        b.text(" | ").coloured(LIGHTRED, "UNFINISHED");
+    if (report.partial)
+    {
+        b.text(" | ").coloured(YELLOW,
+                               make_stringf("PARTIAL (%d trials)",
+                                            report.trials));
+    }
+
+    b.text(" | Spd: ");
+    text_speed(b, report);
+
+    b.text(" | HD: ").number(report.hd);
+    b.text(" | HP: ").number(report.hp_min);
+    if (report.hp_min < report.hp_max)
+        b.text("-").number(report.hp_max);
+    b.text(" | AC/EV: ").number(report.ac).text("/").number(report.ev);
+
+    if (!report.defenses.empty())
+    {
+        b.text(" ");
+        text_tokens(b, report.defenses, "");
+    }
+
+    for (unsigned int i = 0; i < report.attacks.size(); ++i)
+    {
+        b.text(i ? ", " : " | Dam: ");
+        text_attack(b, report.attacks[i]);
+    }
+
+    if (!report.flags.empty())
+    {
+        b.text(" | ");
+        text_tokens(b, report.flags, ", ");
+    }
+
+    text_resists(b, report, false);
+    text_resists(b, report, true);
+
+    if (!report.chunks.text.empty())
+    {
+        b.text(" | Chunks: ")
+         .coloured(report.chunks.colour, report.chunks.text);
+    }
+
+    b.text(" | XP: ").number(report.xp);
+
+    const std::string spells =
+        text_spells(report, current_colour_backend());
+    if (!spells.empty())
+        b.text(" | Sp: ").raw(spells);
+
+    b.text(" | Sz: ").text(report.size);
+    b.text(" | Int: ").text(report.intelligence);
+
+    for (unsigned int i = 0; i < report.distributions.size(); ++i)
+    {
+        const report_distribution &dist = report.distributions[i];
+        b.text(i ? ", " : " | Dist: ").text(uppercase_string(dist.name))
+         .text(make_stringf(" %.1f+/-%.1f p10/50/90 %ld/%ld/%ld", dist.mean,
+                            dist.stddev, dist.p10, dist.p50, dist.p90));
+    }
+
+    for (unsigned int i = 0; i < report.items.size(); ++i)
+    {
+        const report_item &item = report.items[i];
+        const bool new_slot = !i || report.items[i - 1].slot != item.slot;
+        b.text(!i ? " | Items: " : new_slot ? "; " : ", ");
+        if (new_slot)
+            b.text(item.slot).text(" ");
+        b.text(make_stringf("%.0f%% ", item.chance)).text(item.name);
+        if (item.plus_min != item.plus_max)
+            b.text(make_stringf(" %+ld..%+ld", item.plus_min, item.plus_max));
+        else if (item.plus_min)
+            b.text(make_stringf(" %+ld", item.plus_min));
+    }
+
+    if (show_trials)
+        b.text(" | Trials: ").number(report.trials);
+
+    b.text(".\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// JSON
+
+static std::string json_string(const std::string &text)
+{
+    std::string out = "\"";
+    for (unsigned int i = 0; i < text.size(); ++i)
+    {
+        const unsigned char c = text[i];
+        switch (c)
+        {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n";  break;
+        case '\t': out += "\\t";  break;
+        default:
+            if (c < 0x20)
+                out += make_stringf("\\u%04x", c);
+            else
+                out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// "(reach)" -> "reach"; flavour notes are parenthesised for the text report.
+static std::string bare_flavour(const std::string &text)
+{
+    if (text.size() >= 2 && text[0] == '(' && text[text.size() - 1] == ')')
+        return text.substr(1, text.size() - 2);
+    return text;
+}
+
+static bool is_integer(const std::string &text)
+{
+    if (text.empty())
+        return false;
+    for (unsigned int i = (text[0] == '-'); i < text.size(); ++i)
+        if (text[i] < '0' || text[i] > '9')
+            return false;
+    return text != "-";
+}
+
+static std::string json_tokens(const std::vector<report_token> &tokens,
+                               bool bare = false)
+{
+    std::string out = "[";
+    for (unsigned int i = 0; i < tokens.size(); ++i)
+    {
+        if (i)
+            out += ",";
+        out += json_string(bare ? bare_flavour(tokens[i].text)
+                                : tokens[i].text);
+    }
+    return out + "]";
+}
+
+static std::string json_bool(bool value)
+{
+    return value ? "true" : "false";
+}
+
+static std::string json_strings(const std::vector<std::string> &strings)
+{
+    std::string out = "[";
+    for (unsigned int i = 0; i < strings.size(); ++i)
+        out += (i ? "," : "") + json_string(strings[i]);
+    return out + "]";
+}
+
+// The spell sets as arrays of spells, in the order they were gathered.
+static std::string json_spells(const monster_report &report)
+{
+    std::string out = "[";
+    for (unsigned int i = 0; i < report.spell_sets.size(); ++i)
+    {
+        const report_spell_set &set = report.spell_sets[i];
+        out += i ? ",[" : "[";
+        for (unsigned int j = 0; j < set.size(); ++j)
+        {
+            const report_spell &spell = set[j];
+            out += j ? ",{" : "{";
+            out += "\"name\":" + json_string(spell.name);
+            out += ",\"damages\":" + json_strings(spell.damages);
+            out += ",\"flags\":" + json_tokens(spell.flags);
+            if (!spell.heads.empty())
+            {
+                out += ",\"heads\":[";
+                for (unsigned int k = 0; k < spell.heads.size(); ++k)
+                {
+                    out += k ? ",{" : "{";
+                    out += "\"name\":" + json_string(spell.heads[k].first)
+                           + ",\"damage\":"
+                           + json_string(spell.heads[k].second) + "}";
+                }
+                out += "]";
+            }
+            out += "}";
+        }
+        out += "]";
+    }
+    return out + "]";
+}
+
+static std::string emit_json(const monster_report &report, bool show_trials)
+{
+    std::string out = "{";
+    out += "\"name\":" + json_string(report.name);
+    out += ",\"glyph\":" + json_string(report.glyph.text);
+    out += ",\"unfinished\":" + json_bool(report.unfinished);
+    out += make_stringf(",\"speed\":{\"min\":%d,\"max\":%d}",
+                        report.speed_min, report.speed_max);
+
+    out += ",\"energy\":{";
+    for (unsigned int i = 0; i < report.energy.size(); ++i)
+    {
+        if (i)
+            out += ",";
+        out += json_string(report.energy[i].first)
+               + make_stringf(":%d", report.energy[i].second);
+    }
+    out += "}";
+
+    out += ",\"stationary\":" + json_bool(report.stationary);
+    out += make_stringf(",\"hd\":%d", report.hd);
+    out += make_stringf(",\"hp\":{\"min\":%d,\"max\":%d}",
+                        report.hp_min, report.hp_max);
+    out += make_stringf(",\"ac\":%d,\"ev\":%d", report.ac, report.ev);
+    out += ",\"defenses\":" + json_tokens(report.defenses);
+
+    out += ",\"attacks\":[";
+    for (unsigned int i = 0; i < report.attacks.size(); ++i)
+    {
+        const report_attack &attack = report.attacks[i];
+        if (i)
+            out += ",";
+        out += make_stringf("{\"damage\":%d", attack.damage);
+        out += ",\"flavours\":" + json_tokens(attack.flavours, true);
+        out += ",\"per_head\":" + json_bool(attack.per_head) + "}";
+    }
+    out += "]";
+
+    out += ",\"flags\":" + json_tokens(report.flags);
+
+    out += ",\"resists\":{";
+    for (unsigned int i = 0; i < report.resists.size(); ++i)
+    {
+        const report_resist &resist = report.resists[i];
+        if (i)
+            out += ",";
+        out += json_string(resist.name) + ":";
+        if (resist.detail.empty())
+            out += make_stringf("%d", resist.level);
+        else if (is_integer(resist.detail))
+            out += resist.detail;
+        else
+            out += json_string(resist.detail);
+    }
+    out += "}";
+
+    out += ",\"chunks\":";
+    out += report.chunks.text.empty() ? "null"
+                                      : json_string(report.chunks.text);
+    out += make_stringf(",\"xp\":%ld", report.xp);
+    out += ",\"spells\":" + json_spells(report);
+    if (report.random_spells)
+        out += ",\"random_spells\":true";
+    out += ",\"size\":" + json_string(report.size);
+    out += ",\"intelligence\":" + json_string(report.intelligence);
+    if (show_trials || report.partial)
+        out += make_stringf(",\"trials\":%d", report.trials);
+    if (report.partial)
+        out += ",\"partial\":true";
+    if (!report.distributions.empty())
+    {
+        out += ",\"distributions\":{";
+        for (unsigned int i = 0; i < report.distributions.size(); ++i)
+        {
+            const report_distribution &dist = report.distributions[i];
+            if (i)
+                out += ",";
+            out += json_string(dist.name)
+                   + make_stringf(":{\"mean\":%.2f,\"stddev\":%.2f,"
+                                  "\"p10\":%ld,\"p50\":%ld,\"p90\":%ld}",
+                                  dist.mean, dist.stddev, dist.p10, dist.p50,
+                                  dist.p90);
+        }
+        out += "}";
+    }
+    if (!report.items.empty())
+    {
+        out += ",\"items\":[";
+        for (unsigned int i = 0; i < report.items.size(); ++i)
+        {
+            const report_item &item = report.items[i];
+            if (i)
+                out += ",";
+            out += "{\"slot\":" + json_string(item.slot)
+                   + ",\"item\":" + json_string(item.name)
+                   + make_stringf(",\"chance\":%.1f,\"plus_min\":%ld,"
+                                  "\"plus_max\":%ld}",
+                                  item.chance, item.plus_min, item.plus_max);
+        }
+        out += "]";
+    }
+    out += "}\n";
+    return out;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// CSV
+
+static std::string csv_field(const std::string &text)
+{
+    if (text.find_first_of(",\"\n") == std::string::npos)
+        return text;
+    return "\"" + replace_all(text, "\"", "\"\"") + "\"";
+}
+
+static std::string csv_tokens(const std::vector<report_token> &tokens)
+{
+    std::string out;
+    for (unsigned int i = 0; i < tokens.size(); ++i)
+    {
+        if (i)
+            out += "; ";
+        out += tokens[i].text;
+    }
+    return out;
+}
+
+static std::string csv_resists(const monster_report &report, bool vul)
+{
+    std::string out;
+    for (unsigned int i = 0; i < report.resists.size(); ++i)
+    {
+        const report_resist &resist = report.resists[i];
+        if (vul != (resist.level < 0))
+            continue;
+        if (!out.empty())
+            out += "; ";
+        if (!resist.detail.empty())
+            out += resist.name + ":" + resist.detail;
+        else
+            out += make_stringf("%s:%d", resist.name.c_str(),
+                                vul ? -resist.level : resist.level);
+    }
+    return out;
+}
+
+static const report_column csv_columns[] =
+{
+    { "name",            false },
+    { "glyph",           false },
+    { "unfinished",      true  },
+    { "speed_min",       true  },
+    { "speed_max",       true  },
+    { "hd",              true  },
+    { "hp_min",          true  },
+    { "hp_max",          true  },
+    { "ac",              true  },
+    { "ev",              true  },
+    { "defenses",        false },
+    { "attacks",         false },
+    { "flags",           false },
+    { "resists",         false },
+    { "vulnerabilities", false },
+    { "chunks",          false },
+    { "xp",              true  },
+    { "spells",          false },
+    { "size",            false },
+    { "intelligence",    false },
+    { "trials",          true  },
+    { "partial",         true  },
+};
+
+/**
+ * The columns of the tabular form of a report. The trials column is there
+ * if show_trials or show_partial is set, and the partial column (whether
+ * sampling was cut short by the deadline) if show_partial is.
+**/
+std::vector<report_column> report_columns(bool show_trials, bool show_partial)
+{
+    std::vector<report_column> columns(csv_columns,
+                                       csv_columns + ARRAYSZ(csv_columns));
+    if (!show_partial)
+        columns.pop_back();
+    if (!show_trials && !show_partial)
+        columns.pop_back();
+    return columns;
+}
+
+/**
+ * The report as one uncoloured value per report_columns() column, for CSV
+ * rows and database exports.
+**/
+std::vector<std::string> report_fields(const monster_report &report,
+                                       bool show_trials, bool show_partial)
+{
+    std::string attacks;
+    for (unsigned int i = 0; i < report.attacks.size(); ++i)
+    {
+        if (i)
+            attacks += "; ";
+        report_builder b(attacks, COLOUR_NONE);
+        text_attack(b, report.attacks[i]);
+    }
+
+    std::vector<std::string> fields;
+    fields.push_back(report.name);
+    fields.push_back(report.glyph.text);
+    fields.push_back(report.unfinished ? "1" : "0");
+    fields.push_back(make_stringf("%d", report.speed_min));
+    fields.push_back(make_stringf("%d", report.speed_max));
+    fields.push_back(make_stringf("%d", report.hd));
+    fields.push_back(make_stringf("%d", report.hp_min));
+    fields.push_back(make_stringf("%d", report.hp_max));
+    fields.push_back(make_stringf("%d", report.ac));
+    fields.push_back(make_stringf("%d", report.ev));
+    fields.push_back(csv_tokens(report.defenses));
+    fields.push_back(attacks);
+    fields.push_back(csv_tokens(report.flags));
+    fields.push_back(csv_resists(report, false));
+    fields.push_back(csv_resists(report, true));
+    fields.push_back(report.chunks.text);
+    fields.push_back(make_stringf("%ld", report.xp));
+    fields.push_back(text_spells(report, COLOUR_NONE));
+    fields.push_back(report.size);
+    fields.push_back(report.intelligence);
+    if (show_trials || show_partial)
+        fields.push_back(make_stringf("%d", report.trials));
+    if (show_partial)
+        fields.push_back(report.partial ? "1" : "0");
+    return fields;
+}
+
+// CSV rows have an error column after the report_columns(), empty unless
+// the query failed (see emit_report_error()), so that a failed query in a
+// batch still produces a well-formed row.
+std::string report_csv_header(bool show_trials, bool show_partial)
+{
+    const std::vector<report_column> columns =
+        report_columns(show_trials, show_partial);
+    std::string out;
+    for (unsigned int i = 0; i < columns.size(); ++i)
+        out += std::string(columns[i].name) + ",";
+    return out + "error\n";
+}
+
+static std::string emit_csv(const monster_report &report, bool show_trials,
+                            bool show_partial)
+{
+    const std::vector<std::string> fields =
+        report_fields(report, show_trials, show_partial);
+    std::string out;
+    for (unsigned int i = 0; i < fields.size(); ++i)
+        out += csv_field(fields[i]) + ",";
+    return out + "\n";
+}
+
+/**
+ * Append a report in the given format to out. Callers running many queries
+ * can reuse one buffer, clearing it between reports. Text and JSON reports
+ * always say if they are partial; show_partial adds the CSV columns for it.
+**/
+void emit_report(const monster_report &report, report_format format,
+                 bool show_trials, bool show_partial, std::string &out)
+{
+    switch (format)
+    {
+    case REPORT_JSON:
+        out += emit_json(report, show_trials);
+        break;
+    case REPORT_CSV:
+        out += emit_csv(report, show_trials, show_partial);
+        break;
+    case REPORT_TEXT:
+    default:
+        emit_text(report, show_trials, out);
+        break;
+    }
+}
+
+/**
+ * Format an error (unknown monster, bad spec) for the given output format,
+ * so that a batch of JSON reports stays one object per line and a batch of
+ * CSV rows stays under one header: the CSV row is empty but for its error
+ * column.
+**/
+std::string emit_report_error(const std::string &message,
+                              report_format format, bool show_trials,
+                              bool show_partial)
+{
+    std::string text = message;
+    trim_string(text);
+
+    if (format == REPORT_JSON)
+        return "{\"error\":" + json_string(text) + "}\n";
+    if (format == REPORT_CSV)
+    {
+        return std::string(report_columns(show_trials, show_partial).size(),
+                           ',')
+               + csv_field(text) + "\n";
+    }
+    return text + "\n";
+}
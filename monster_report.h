@@ -0,0 +1,165 @@
+/**
+ * @file monster_report.h
+ *
+ * @section DESCRIPTION
+ *
+ * The stats gathered for one monster query, kept apart from how they are
+ * shown. Text output is the one-line IRC/terminal report; JSON and CSV are
+ * for machine consumers and carry no colour codes.
+ *
+**/
+
+#ifndef __MONSTER_REPORT_H__
+#define __MONSTER_REPORT_H__
+
+#include "AppHdr.h"
+
+#include "report_builder.h"
+
+enum report_format
+{
+    REPORT_TEXT,
+    REPORT_JSON,
+    REPORT_CSV,
+};
+
+// A piece of report text and the colour it's shown in (0 for none).
+struct report_token
+{
+    int colour;
+    std::string text;
+
+    report_token() : colour(0) { }
+    report_token(const char *_text) : colour(0), text(_text) { }
+    report_token(const std::string &_text) : colour(0), text(_text) { }
+    report_token(int _colour, const std::string &_text)
+        : colour(_colour), text(_text)
+    {
+    }
+};
+
+struct report_attack
+{
+    int damage;
+    // Attack type and flavour notes, e.g. "(reach)" or "(fire:10-19)".
+    std::vector<report_token> flavours;
+    bool per_head;
+
+    report_attack() : damage(0), per_head(false) { }
+};
+
+// A resistance (level > 0) or vulnerability (level < 0).
+struct report_resist
+{
+    std::string name;
+    int colour;
+    int level;
+    // If set, shown as name(detail) instead of with +s; used for magic
+    // resistance.
+    std::string detail;
+
+    report_resist() : colour(0), level(0) { }
+};
+
+// A spell a monster can cast, with every damage seen for it over the
+// trials.
+struct report_spell
+{
+    std::string name;
+    std::vector<std::string> damages;
+    // The flags of the spell's slot: !AM, !sil, breath, emergency.
+    std::vector<report_token> flags;
+    // For a serpent of Hell's breath, which differs per head: the breath
+    // and damage of each head, in head order.
+    std::vector<std::pair<std::string, std::string> > heads;
+};
+
+// The spells of one sampled monster, in slot order.
+typedef std::vector<report_spell> report_spell_set;
+
+// The spread of a stat over the sampled monsters.
+struct report_distribution
+{
+    std::string name;
+    double mean;
+    double stddev;
+    long p10, p50, p90;
+
+    report_distribution() : mean(0), stddev(0), p10(0), p50(0), p90(0) { }
+};
+
+// How often sampled monsters carried a kind of item in a slot.
+struct report_item
+{
+    std::string slot;
+    std::string name;
+    // Percent of trials.
+    double chance;
+    long plus_min, plus_max;
+
+    report_item() : chance(0), plus_min(0), plus_max(0) { }
+};
+
+struct monster_report
+{
+    std::string name;
+    report_token glyph;
+    bool unfinished;
+
+    int speed_min, speed_max;
+    // Action energy costs that differ from normal, as (action, percent).
+    std::vector<std::pair<std::string, int> > energy;
+    bool stationary;
+
+    int hd;
+    int hp_min, hp_max;
+    int ac, ev;
+    std::vector<report_token> defenses;
+    std::vector<report_attack> attacks;
+    std::vector<report_token> flags;
+    std::vector<report_resist> resists;
+    report_token chunks;
+    long xp;
+    // The distinct spell sets seen; empty if the monster has no spells,
+    // or if random_spells is set because they are picked at random.
+    std::vector<report_spell_set> spell_sets;
+    bool random_spells;
+    std::string size;
+    std::string intelligence;
+
+    int trials;
+    // Sampling was cut short by the deadline, so the figures are rougher.
+    bool partial;
+    // Only gathered on request; not part of the CSV columns.
+    std::vector<report_distribution> distributions;
+    std::vector<report_item> items;
+
+    monster_report()
+        : unfinished(false), speed_min(0), speed_max(0), stationary(false),
+          hd(0), hp_min(0), hp_max(0), ac(0), ev(0), xp(0),
+          random_spells(false), trials(0), partial(false)
+    {
+    }
+};
+
+// A column of the tabular (CSV and database) form of a report.
+struct report_column
+{
+    const char *name;
+    bool numeric;
+};
+
+bool parse_report_format(const std::string &name, report_format &format);
+
+void emit_report(const monster_report &report, report_format format,
+                 bool show_trials, bool show_partial, std::string &out);
+std::string emit_report_error(const std::string &message,
+                              report_format format, bool show_trials,
+                              bool show_partial);
+std::string report_csv_header(bool show_trials, bool show_partial);
+
+std::vector<report_column> report_columns(bool show_trials, bool show_partial);
+std::vector<std::string> report_fields(const monster_report &report,
+                                       bool show_trials, bool show_partial);
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @file name_index.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Names are kept sorted by their lowercased key, so completing a prefix is
+ * a binary search followed by a scan of the matching range. Suggestions for
+ * misspelt names come from a BK-tree over the same keys: by the triangle
+ * inequality, only children whose distance from a node is within the
+ * search radius of the query's distance from it can hold a match, so a
+ * search visits a small part of the tree.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "name_index.h"
+#include "stringutil.h"
+
+#include <algorithm>
+
+// Suggestions are at most this far from the name asked for, and never more
+// than a third of its length (rounded up) away.
+#define MAX_SUGGEST_DISTANCE 3
+
+int edit_distance(const std::string &a, const std::string &b)
+{
+    std::vector<int> row(b.size() + 1);
+    for (unsigned int j = 0; j <= b.size(); ++j)
+        row[j] = j;
+
+    for (unsigned int i = 1; i <= a.size(); ++i)
+    {
+        int diagonal = row[0];
+        row[0] = i;
+        for (unsigned int j = 1; j <= b.size(); ++j)
+        {
+            const int above = row[j];
+            row[j] = std::min(std::min(row[j] + 1, row[j - 1] + 1),
+                              diagonal + (a[i - 1] != b[j - 1]));
+            diagonal = above;
+        }
+    }
+    return row[b.size()];
+}
+
+name_index::name_index()
+{
+}
+
+std::string name_index::key(std::string name)
+{
+    trim_string(name);
+    lowercase(name);
+    return name;
+}
+
+void name_index::add(const std::string &name)
+{
+    entry e;
+    e.key = key(name);
+    e.name = name;
+    if (!e.key.empty())
+        names.push_back(e);
+}
+
+void name_index::build()
+{
+    std::stable_sort(names.begin(), names.end());
+
+    // Keep the first name added for each key.
+    std::vector<entry> unique;
+    for (unsigned int i = 0; i < names.size(); ++i)
+        if (unique.empty() || unique.back().key != names[i].key)
+            unique.push_back(names[i]);
+    names.swap(unique);
+
+    tree.clear();
+    tree.reserve(names.size());
+    for (unsigned int i = 0; i < names.size(); ++i)
+        bk_insert(i);
+}
+
+void name_index::bk_insert(int e)
+{
+    bk_node leaf;
+    leaf.entry = e;
+
+    if (tree.empty())
+    {
+        tree.push_back(leaf);
+        return;
+    }
+
+    int node = 0;
+    while (true)
+    {
+        const int distance = edit_distance(names[e].key,
+                                           names[tree[node].entry].key);
+        int child = -1;
+        for (unsigned int i = 0; i < tree[node].children.size(); ++i)
+            if (tree[node].children[i].first == distance)
+                child = tree[node].children[i].second;
+
+        if (child < 0)
+        {
+            tree[node].children.push_back(
+                std::make_pair(distance, (int) tree.size()));
+            tree.push_back(leaf);
+            return;
+        }
+        node = child;
+    }
+}
+
+void name_index::bk_search(int node, const std::string &k, int max_distance,
+                           std::vector<std::pair<int, int> > &matches) const
+{
+    const bk_node &n = tree[node];
+    const int distance = edit_distance(k, names[n.entry].key);
+    if (distance <= max_distance)
+        matches.push_back(std::make_pair(distance, n.entry));
+
+    for (unsigned int i = 0; i < n.children.size(); ++i)
+    {
+        if (abs(n.children[i].first - distance) <= max_distance)
+            bk_search(n.children[i].second, k, max_distance, matches);
+    }
+}
+
+bool name_index::contains(const std::string &name) const
+{
+    entry e;
+    e.key = key(name);
+    return std::binary_search(names.begin(), names.end(), e);
+}
+
+/**
+ * Return up to max_results names starting with prefix, in alphabetical
+ * order.
+**/
+std::vector<std::string> name_index::complete(const std::string &prefix,
+                                              unsigned int max_results) const
+{
+    entry e;
+    e.key = key(prefix);
+
+    std::vector<std::string> results;
+    for (std::vector<entry>::const_iterator i =
+             std::lower_bound(names.begin(), names.end(), e);
+         i != names.end() && results.size() < max_results
+         && !i->key.compare(0, e.key.size(), e.key);
+         ++i)
+    {
+        results.push_back(i->name);
+    }
+    return results;
+}
+
+/**
+ * Return up to max_results names close to name, closest first. Names that
+ * name is a prefix of fill any remaining places.
+**/
+std::vector<std::string> name_index::suggest(const std::string &name,
+                                             unsigned int max_results) const
+{
+    const std::string k = key(name);
+    std::vector<std::string> results;
+    if (tree.empty() || k.empty())
+        return results;
+
+    const int max_distance = std::min<int>(MAX_SUGGEST_DISTANCE,
+                                           (k.size() + 2) / 3);
+    std::vector<std::pair<int, int> > matches;
+    bk_search(0, k, max_distance, matches);
+    // Entries are in key order, so ties between equally distant names are
+    // broken alphabetically.
+    std::sort(matches.begin(), matches.end());
+
+    for (unsigned int i = 0; i < matches.size() && i < max_results; ++i)
+        results.push_back(names[matches[i].second].name);
+
+    const std::vector<std::string> completions = complete(k, max_results);
+    for (unsigned int i = 0;
+         i < completions.size() && results.size() < max_results; ++i)
+    {
+        if (std::find(results.begin(), results.end(), completions[i])
+            == results.end())
+        {
+            results.push_back(completions[i]);
+        }
+    }
+    return results;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file name_index.h
+ *
+ * @section DESCRIPTION
+ *
+ * An index of names for prefix completion and "did you mean" suggestions.
+ *
+**/
+
+#ifndef __NAME_INDEX_H__
+#define __NAME_INDEX_H__
+
+#include "AppHdr.h"
+
+class name_index
+{
+public:
+    name_index();
+
+    // Names are matched case-insensitively but returned as added.
+    void add(const std::string &name);
+    // Sort the names and build the edit distance tree; call once after the
+    // last add() and before any lookup.
+    void build();
+
+    int size() const { return names.size(); }
+    bool contains(const std::string &name) const;
+
+    std::vector<std::string> complete(const std::string &prefix,
+                                      unsigned int max_results) const;
+    std::vector<std::string> suggest(const std::string &name,
+                                     unsigned int max_results) const;
+
+    static std::string key(std::string name);
+
+private:
+    struct entry
+    {
+        std::string key;
+        std::string name;
+
+        bool operator < (const entry &other) const
+        {
+            return key < other.key;
+        }
+    };
+
+    // A BK-tree node: the entry it holds and its children, each at a
+    // distinct edit distance from it.
+    struct bk_node
+    {
+        int entry;
+        std::vector<std::pair<int, int> > children;
+    };
+
+    std::vector<entry> names;
+    std::vector<bk_node> tree;
+
+    void bk_insert(int entry);
+    void bk_search(int node, const std::string &key, int max_distance,
+                   std::vector<std::pair<int, int> > &matches) const;
+};
+
+int edit_distance(const std::string &a, const std::string &b);
+
+#endif
@@ -0,0 +1,235 @@
+/**
+ * @file query_server.cc
+ *
+ * @section DESCRIPTION
+ *
+ * A persistent query server listening on a Unix domain socket, so that the
+ * (expensive) crawl initialisation only has to be done once.
+ *
+ * The protocol is line based. Each request is a single line:
+ *
+ *     <request id> <query>
+ *
+ * where the request id is any token not containing whitespace, and the query
+ * is exactly what would be passed on the command line (including "spec:"
+ * queries). Each request is answered with a single line:
+ *
+ *     <request id> <exit status> <report>
+ *
+ * Clients may pipeline as many requests as they like on one connection;
+ * replies on a connection are sent in request order, but the ids let clients
+ * match them up regardless. Queries are answered one at a time, since crawl's
+ * globals can't be shared between concurrent queries: requests from all
+ * clients are served in turn, so a slow query holds up every request
+ * queued behind it, on any connection, until it finishes or its alarm
+ * kills it. Clients that need low latency should set a --deadline.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "query_server.h"
+#include "stringutil.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Requests longer than this are rejected and the connection dropped.
+static const std::string::size_type MAX_REQUEST_LENGTH = 4096;
+
+static const int MAX_CLIENTS = 64;
+
+struct query_client
+{
+    int fd;
+    std::string input;
+};
+
+static bool write_fully(int fd, const std::string &data)
+{
+    const char *buf = data.data();
+    std::string::size_type left = data.size();
+    while (left > 0)
+    {
+        const ssize_t written = write(fd, buf, left);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += written;
+        left -= written;
+    }
+    return true;
+}
+
+/**
+ * Run one request line through the handler and build the reply line.
+ *
+ * Reports are single lines already, but any embedded newlines are folded
+ * into spaces so that a reply can never be mistaken for two.
+**/
+static std::string answer_request(const std::string &line,
+                                  query_handler handler)
+{
+    std::string::size_type split = line.find_first_of(" \t");
+    const std::string id = line.substr(0, split);
+    std::string query;
+    if (split != std::string::npos)
+        query = line.substr(split + 1);
+
+    std::string report;
+    const int status = handler(query, report);
+
+    while (!report.empty() && report[report.size() - 1] == '\n')
+        report.erase(report.size() - 1);
+    std::replace(report.begin(), report.end(), '\n', ' ');
+
+    return make_stringf("%s %d %s\n", id.c_str(), status, report.c_str());
+}
+
+/**
+ * Answer every complete line buffered for a client.
+ *
+ * @return false if the client should be disconnected.
+**/
+static bool process_client_input(query_client &client, query_handler handler)
+{
+    std::string::size_type eol;
+    while ((eol = client.input.find('\n')) != std::string::npos)
+    {
+        std::string line = client.input.substr(0, eol);
+        client.input.erase(0, eol + 1);
+
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line.find_first_not_of(" \t") == std::string::npos)
+            continue;
+
+        if (!write_fully(client.fd, answer_request(line, handler)))
+            return false;
+    }
+
+    if (client.input.size() > MAX_REQUEST_LENGTH)
+    {
+        write_fully(client.fd, "- 1 request too long\n");
+        return false;
+    }
+    return true;
+}
+
+static int open_listen_socket(const std::string &socket_path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof addr.sun_path)
+    {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path.c_str());
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    // A stale socket from a previous server would make bind() fail.
+    unlink(socket_path.c_str());
+    if (bind(fd, (sockaddr *) &addr, sizeof addr) < 0
+        || listen(fd, 16) < 0)
+    {
+        perror(socket_path.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Serve queries on a Unix domain socket until killed.
+ *
+ * @param socket_path Path of the socket to create; any existing file at that
+ *                    path is removed first.
+ * @param handler     Called once per request, with crawl already initialised.
+ * @return A non-zero exit status if the socket could not be set up.
+**/
+int serve_queries(const std::string &socket_path, query_handler handler)
+{
+    const int listen_fd = open_listen_socket(socket_path);
+    if (listen_fd < 0)
+        return 1;
+
+    // A client hanging up before reading its reply must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<query_client> clients;
+    std::vector<pollfd> fds;
+    char buf[4096];
+
+    while (true)
+    {
+        fds.clear();
+        pollfd lfd = { listen_fd, POLLIN, 0 };
+        fds.push_back(lfd);
+        for (unsigned int i = 0; i < clients.size(); ++i)
+        {
+            pollfd cfd = { clients[i].fd, POLLIN, 0 };
+            fds.push_back(cfd);
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            close(listen_fd);
+            return 1;
+        }
+
+        // Walk backwards so that dropping a client doesn't disturb the
+        // indices still to be visited.
+        for (int i = clients.size() - 1; i >= 0; --i)
+        {
+            if (!fds[i + 1].revents)
+                continue;
+
+            query_client &client = clients[i];
+            const ssize_t nread = read(client.fd, buf, sizeof buf);
+            bool keep = nread > 0 || nread < 0 && errno == EINTR;
+            if (nread > 0)
+            {
+                client.input.append(buf, nread);
+                keep = process_client_input(client, handler);
+            }
+
+            if (!keep)
+            {
+                close(client.fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            const int fd = accept(listen_fd, 0, 0);
+            if (fd >= 0 && (int) clients.size() >= MAX_CLIENTS)
+                close(fd);
+            else if (fd >= 0)
+            {
+                query_client client;
+                client.fd = fd;
+                clients.push_back(client);
+            }
+        }
+    }
+}
@@ -0,0 +1,18 @@
+/**
+ * query_server.h
+**/
+
+#ifndef __QUERY_SERVER_H__
+#define __QUERY_SERVER_H__
+
+#include "AppHdr.h"
+
+/**
+ * Answer a single query, appending the full report to report. Returns the
+ * exit status the one-shot binary would have used for the same query.
+**/
+typedef int (*query_handler)(const std::string &query, std::string &report);
+
+int serve_queries(const std::string &socket_path, query_handler handler);
+
+#endif
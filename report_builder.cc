@@ -0,0 +1,309 @@
+/**
+ * @file report_builder.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Colour backends for report text: mIRC codes for the IRC bot, ANSI
+ * escapes for terminals, HTML spans for web pages, or none at all.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "colour.h"
+#include "report_builder.h"
+#include "stringutil.h"
+
+#include <unistd.h>
+
+#define NUM_REPORT_COLOURS 16
+
+#ifdef CONTROL
+#undef CONTROL
+#endif
+#define CONTROL(x) char(x - 'A' + 1)
+
+static colour_backend report_backend = COLOUR_AUTO;
+static colour_backend detected_backend = COLOUR_AUTO;
+
+static const char *irc_codes[NUM_REPORT_COLOURS] = {
+    "",
+    "02",
+    "03",
+    "10",
+    "05",
+    "06",
+    "07",
+    "15",
+    "14",
+    "12",
+    "09",
+    "11",
+    "04",
+    "13",
+    "08",
+    "00"
+};
+
+static const int bgr[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+// The console palette, for HTML.
+static const char *html_colours[NUM_REPORT_COLOURS] = {
+    "#000000",
+    "#0000aa",
+    "#00aa00",
+    "#00aaaa",
+    "#aa0000",
+    "#aa00aa",
+    "#aa5500",
+    "#aaaaaa",
+    "#555555",
+    "#5555ff",
+    "#55ff55",
+    "#55ffff",
+    "#ff5555",
+    "#ff55ff",
+    "#ffff55",
+    "#ffffff"
+};
+
+struct colour_escapes
+{
+    // Indexed by colour; empty for colours that aren't marked up.
+    std::string open[NUM_REPORT_COLOURS];
+    std::string close;
+};
+
+static colour_escapes escapes[COLOUR_HTML + 1];
+
+static void init_escapes()
+{
+    static bool initialised = false;
+    if (initialised)
+        return;
+    initialised = true;
+
+    for (int c = 1; c < NUM_REPORT_COLOURS; ++c)
+    {
+        escapes[COLOUR_IRC].open[c] = std::string(1, CONTROL('C'))
+                                      + irc_codes[c];
+        escapes[COLOUR_ANSI].open[c] = make_stringf("\e[0;3%d%sm", bgr[c & 7],
+                                                    (c & 8) ? ";1" : "");
+        escapes[COLOUR_HTML].open[c] =
+            make_stringf("<span style=\"color:%s\">", html_colours[c]);
+    }
+    escapes[COLOUR_IRC].close = std::string(1, CONTROL('O'));
+    escapes[COLOUR_ANSI].close = "\e[0m";
+    escapes[COLOUR_HTML].close = "</span>";
+}
+
+static colour_backend resolve_backend(colour_backend backend)
+{
+    if (backend != COLOUR_AUTO)
+        return backend;
+
+    if (detected_backend == COLOUR_AUTO)
+        detected_backend = isatty(1) ? COLOUR_ANSI : COLOUR_IRC;
+    return detected_backend;
+}
+
+static const std::string *open_escape(colour_backend backend, int colour)
+{
+    if (is_element_colour(colour))
+        colour = element_colour(colour, true);
+    if (colour <= 0 || colour >= NUM_REPORT_COLOURS)
+        return 0;
+
+    const std::string &open = escapes[backend].open[colour];
+    return open.empty() ? 0 : &open;
+}
+
+report_builder::report_builder(std::string &buffer, colour_backend _backend)
+    : buf(buffer), backend(resolve_backend(_backend))
+{
+    init_escapes();
+}
+
+void report_builder::append_escaped(const char *s, size_t len)
+{
+    if (backend != COLOUR_HTML)
+    {
+        buf.append(s, len);
+        return;
+    }
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        switch (s[i])
+        {
+        case '&': buf += "&amp;"; break;
+        case '<': buf += "&lt;"; break;
+        case '>': buf += "&gt;"; break;
+        case '"': buf += "&quot;"; break;
+        default:  buf += s[i];
+        }
+    }
+}
+
+report_builder &report_builder::text(const char *s)
+{
+    append_escaped(s, strlen(s));
+    return *this;
+}
+
+report_builder &report_builder::text(const std::string &s)
+{
+    append_escaped(s.data(), s.size());
+    return *this;
+}
+
+report_builder &report_builder::repeat(char c, int count)
+{
+    if (count > 0)
+        buf.append(count, c);
+    return *this;
+}
+
+report_builder &report_builder::raw(const std::string &s)
+{
+    buf += s;
+    return *this;
+}
+
+report_builder &report_builder::number(long n)
+{
+    char digits[24];
+    char *p = digits + sizeof digits;
+    unsigned long u = n < 0 ? -(unsigned long) n : n;
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    }
+    while (u);
+    if (n < 0)
+        *--p = '-';
+    buf.append(p, digits + sizeof digits - p);
+    return *this;
+}
+
+report_builder &report_builder::begin_colour(int colour)
+{
+    if (const std::string *open = open_escape(backend, colour))
+        buf += *open;
+    return *this;
+}
+
+// colour must be the colour passed to the matching begin_colour().
+report_builder &report_builder::end_colour(int colour)
+{
+    if (open_escape(backend, colour))
+        buf += escapes[backend].close;
+    return *this;
+}
+
+report_builder &report_builder::coloured(int colour, const char *s)
+{
+    const std::string *open = open_escape(backend, colour);
+    if (open)
+        buf += *open;
+    text(s);
+    if (open)
+        buf += escapes[backend].close;
+    return *this;
+}
+
+report_builder &report_builder::coloured(int colour, const std::string &s)
+{
+    const std::string *open = open_escape(backend, colour);
+    if (open)
+        buf += *open;
+    text(s);
+    if (open)
+        buf += escapes[backend].close;
+    return *this;
+}
+
+colour_backend current_colour_backend()
+{
+    return resolve_backend(report_backend);
+}
+
+/**
+ * Choose how text reports are coloured. Machine-readable formats switch
+ * colour off before any report text is built, so that strings gathered
+ * during sampling (spell lists, for instance) are plain too.
+**/
+void set_report_colour(colour_backend backend)
+{
+    report_backend = backend;
+}
+
+bool parse_colour_backend(const std::string &name, colour_backend &backend)
+{
+    if (name == "auto")
+        backend = COLOUR_AUTO;
+    else if (name == "plain" || name == "none")
+        backend = COLOUR_NONE;
+    else if (name == "irc")
+        backend = COLOUR_IRC;
+    else if (name == "ansi")
+        backend = COLOUR_ANSI;
+    else if (name == "html")
+        backend = COLOUR_HTML;
+    else
+        return false;
+    return true;
+}
+
+std::string colour(int colour, std::string text)
+{
+    std::string out;
+    report_builder(out, report_backend).coloured(colour, text);
+    return out;
+}
+
+static std::string recolour_as(const std::string &irc_text,
+                               colour_backend backend)
+{
+    std::string out;
+    report_builder b(out, backend);
+
+    std::string::size_type pos = 0;
+    while (pos < irc_text.size())
+    {
+        const std::string::size_type start = irc_text.find(CONTROL('C'), pos);
+        b.text(irc_text.substr(pos, start - pos));
+        if (start == std::string::npos)
+            break;
+
+        const std::string code = irc_text.substr(start + 1, 2);
+        std::string::size_type text_start = start + 3;
+        if (!irc_text.compare(text_start, 3, ",01"))
+            text_start += 3;
+
+        std::string::size_type end = irc_text.find(CONTROL('O'), text_start);
+        if (end == std::string::npos)
+            end = irc_text.size();
+        pos = end + 1;
+
+        int col = 0;
+        for (int i = 1; i < NUM_REPORT_COLOURS; ++i)
+            if (code == irc_codes[i])
+                col = i;
+
+        b.coloured(col, irc_text.substr(text_start, end - text_start));
+    }
+    return out;
+}
+
+/**
+ * Convert text coloured with mIRC codes to the current backend. Reports
+ * are stored with mIRC codes (see monster_db.cc); the codes map one to one
+ * onto crawl colours, so nothing is lost.
+**/
+std::string recolour_report(const std::string &irc_text)
+{
+    const colour_backend backend = current_colour_backend();
+    return backend == COLOUR_IRC ? irc_text : recolour_as(irc_text, backend);
+}
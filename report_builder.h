@@ -0,0 +1,60 @@
+/**
+ * @file report_builder.h
+ *
+ * @section DESCRIPTION
+ *
+ * Append coloured report text to a caller's buffer. The escape sequences
+ * for each colour backend are built once, so colouring a token is a pair
+ * of appends.
+ *
+**/
+
+#ifndef __REPORT_BUILDER_H__
+#define __REPORT_BUILDER_H__
+
+#include "AppHdr.h"
+
+// How text reports are coloured. COLOUR_AUTO picks ANSI escapes if stdout
+// is a terminal and mIRC codes otherwise, deciding once per process.
+enum colour_backend
+{
+    COLOUR_AUTO,
+    COLOUR_NONE,
+    COLOUR_IRC,
+    COLOUR_ANSI,
+    COLOUR_HTML,
+};
+
+class report_builder
+{
+public:
+    report_builder(std::string &buffer, colour_backend backend);
+
+    // Plain text; escaped for HTML.
+    report_builder &text(const char *s);
+    report_builder &text(const std::string &s);
+    report_builder &repeat(char c, int count);
+    // Text already rendered for this backend, such as colour() output.
+    report_builder &raw(const std::string &s);
+    report_builder &number(long n);
+
+    report_builder &begin_colour(int colour);
+    report_builder &end_colour(int colour);
+    report_builder &coloured(int colour, const char *s);
+    report_builder &coloured(int colour, const std::string &s);
+
+private:
+    std::string &buf;
+    colour_backend backend;
+
+    void append_escaped(const char *s, size_t len);
+};
+
+colour_backend current_colour_backend();
+void set_report_colour(colour_backend backend);
+bool parse_colour_backend(const std::string &name, colour_backend &backend);
+
+std::string colour(int colour, std::string text);
+std::string recolour_report(const std::string &irc_text);
+
+#endif
@@ -0,0 +1,224 @@
+/**
+ * @file report_snapshot.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Reading, writing and comparing report snapshots (see report_snapshot.h).
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "file_util.h"
+#include "report_snapshot.h"
+#include "stringutil.h"
+
+#include <algorithm>
+
+// Fields are tab-separated and entries a line each.
+static std::string snapshot_field(const std::string &field)
+{
+    return replace_all_of(field, "\t\n", " ");
+}
+
+report_snapshot::report_snapshot()
+{
+}
+
+/**
+ * Read a snapshot written by write(), replacing this one.
+ *
+ * @return Whether the file could be read and is a whole snapshot.
+ *
+**/
+bool report_snapshot::load(const std::string &path)
+{
+    *this = report_snapshot();
+
+    std::string contents;
+    if (!read_file(path, contents))
+        return false;
+    const std::vector<std::string> lines =
+        split_string("\n", contents, false, true);
+
+    // The file ends with a newline, so the last segment is empty.
+    if (lines.size() < 5 || lines[0] != REPORT_SNAPSHOT_HEADER
+        || lines[1].find("version ") != 0 || lines[2].find("settings ") != 0
+        || lines[3].find("columns\t") != 0 || !lines.back().empty())
+    {
+        return false;
+    }
+    version = lines[1].substr(strlen("version "));
+    settings = lines[2].substr(strlen("settings "));
+    columns = split_string("\t", lines[3], false, true);
+    // Drop "columns" and the key and fingerprint headings.
+    if (columns.size() < 3)
+        return false;
+    columns.erase(columns.begin(), columns.begin() + 3);
+
+    for (unsigned int i = 4; i < lines.size() - 1; ++i)
+    {
+        std::vector<std::string> fields =
+            split_string("\t", lines[i], false, true);
+        if (fields.size() != columns.size() + 2)
+        {
+            *this = report_snapshot();
+            return false;
+        }
+
+        snapshot_entry entry;
+        entry.key = fields[0];
+        entry.fingerprint = strtoull(fields[1].c_str(), NULL, 16);
+        entry.fields.assign(fields.begin() + 2, fields.end());
+        add(entry);
+    }
+    return true;
+}
+
+/**
+ * Write the snapshot, under a temporary name renamed into place.
+ *
+**/
+bool report_snapshot::write(const std::string &path) const
+{
+    return write_file_atomically(path, [this](FILE *out)
+    {
+        fprintf(out, "%s\nversion %s\nsettings %s\ncolumns\tkey\tfingerprint",
+                REPORT_SNAPSHOT_HEADER, snapshot_field(version).c_str(),
+                snapshot_field(settings).c_str());
+        for (unsigned int i = 0; i < columns.size(); ++i)
+            fprintf(out, "\t%s", snapshot_field(columns[i]).c_str());
+        fputc('\n', out);
+
+        for (unsigned int i = 0; i < all.size(); ++i)
+        {
+            fprintf(out, "%s\t%016llx", snapshot_field(all[i].key).c_str(),
+                    (unsigned long long) all[i].fingerprint);
+            for (unsigned int j = 0; j < all[i].fields.size(); ++j)
+            {
+                fprintf(out, "\t%s",
+                        snapshot_field(all[i].fields[j]).c_str());
+            }
+            fputc('\n', out);
+        }
+    });
+}
+
+// Add an entry, replacing any with the same key.
+void report_snapshot::add(const snapshot_entry &entry)
+{
+    std::map<std::string, int>::const_iterator found = by_key.find(entry.key);
+    if (found != by_key.end())
+        all[found->second] = entry;
+    else
+    {
+        by_key[entry.key] = all.size();
+        all.push_back(entry);
+    }
+}
+
+const snapshot_entry *report_snapshot::find(const std::string &key) const
+{
+    std::map<std::string, int>::const_iterator found = by_key.find(key);
+    return found == by_key.end() ? NULL : &all[found->second];
+}
+
+static std::string column_value(const report_snapshot &snapshot,
+                                const snapshot_entry &entry,
+                                const std::string &column)
+{
+    for (unsigned int i = 0; i < snapshot.columns.size(); ++i)
+        if (snapshot.columns[i] == column)
+            return i < entry.fields.size() ? entry.fields[i] : "";
+    return "";
+}
+
+/**
+ * Compare two snapshots field by field, matching monsters by key and
+ * fields by column name. Changes are in the order of after, then the
+ * monsters only in before.
+ *
+**/
+std::vector<snapshot_change> diff_snapshots(const report_snapshot &before,
+                                            const report_snapshot &after)
+{
+    // Every column of either snapshot, in after's order.
+    std::vector<std::string> columns = after.columns;
+    for (unsigned int i = 0; i < before.columns.size(); ++i)
+    {
+        if (std::find(columns.begin(), columns.end(), before.columns[i])
+            == columns.end())
+        {
+            columns.push_back(before.columns[i]);
+        }
+    }
+
+    std::vector<snapshot_change> changes;
+    const std::vector<snapshot_entry> &entries = after.entries();
+    for (unsigned int i = 0; i < entries.size(); ++i)
+    {
+        snapshot_change change;
+        change.key = entries[i].key;
+
+        const snapshot_entry *old = before.find(entries[i].key);
+        if (!old)
+        {
+            change.kind = snapshot_change::ADDED;
+            changes.push_back(change);
+            continue;
+        }
+
+        change.kind = snapshot_change::CHANGED;
+        for (unsigned int c = 0; c < columns.size(); ++c)
+        {
+            snapshot_field_change field;
+            field.column = columns[c];
+            field.before = column_value(before, *old, columns[c]);
+            field.after = column_value(after, entries[i], columns[c]);
+            if (field.before != field.after)
+                change.fields.push_back(field);
+        }
+        if (!change.fields.empty())
+            changes.push_back(change);
+    }
+
+    const std::vector<snapshot_entry> &old_entries = before.entries();
+    for (unsigned int i = 0; i < old_entries.size(); ++i)
+    {
+        if (!after.find(old_entries[i].key))
+        {
+            snapshot_change change;
+            change.kind = snapshot_change::REMOVED;
+            change.key = old_entries[i].key;
+            changes.push_back(change);
+        }
+    }
+    return changes;
+}
+
+/**
+ * One line describing a change, e.g.
+ *
+ *     orc warrior: hp_max 24 -> 30; xp 45 -> 52
+ *
+**/
+std::string format_snapshot_change(const snapshot_change &change)
+{
+    if (change.kind == snapshot_change::ADDED)
+        return "+ " + change.key;
+    if (change.kind == snapshot_change::REMOVED)
+        return "- " + change.key;
+
+    std::string line = change.key + ":";
+    for (unsigned int i = 0; i < change.fields.size(); ++i)
+    {
+        const snapshot_field_change &field = change.fields[i];
+        line += make_stringf("%s %s %s -> %s", i ? ";" : "",
+                             field.column.c_str(),
+                             field.before.empty() ? "(none)"
+                                                  : field.before.c_str(),
+                             field.after.empty() ? "(none)"
+                                                 : field.after.c_str());
+    }
+    return line;
+}
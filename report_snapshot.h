@@ -0,0 +1,87 @@
+/**
+ * @file report_snapshot.h
+ *
+ * @section DESCRIPTION
+ *
+ * A saved copy of every monster's report, for finding what a crawl update
+ * changed. The snapshot is a text file:
+ *
+ *     monster-snapshot 1
+ *     version <crawl version>
+ *     settings <the trial settings the reports were sampled with>
+ *     columns <key> <fingerprint> <report column names...>
+ *     <key> <fingerprint> <report fields...>
+ *     ...
+ *
+ * with tab-separated fields. The key is the name a monster was queried by
+ * and the fingerprint a hash of the static data its report depends on, so
+ * that a later build only needs to sample monsters whose fingerprint has
+ * changed.
+ *
+**/
+
+#ifndef __REPORT_SNAPSHOT_H__
+#define __REPORT_SNAPSHOT_H__
+
+#include "AppHdr.h"
+
+#include <map>
+#include <stdint.h>
+
+#define REPORT_SNAPSHOT_HEADER "monster-snapshot 1"
+
+struct snapshot_entry
+{
+    std::string key;
+    uint64_t fingerprint;
+    std::vector<std::string> fields;
+};
+
+class report_snapshot
+{
+public:
+    report_snapshot();
+
+    bool load(const std::string &path);
+    bool write(const std::string &path) const;
+
+    std::string version;
+    std::string settings;
+    std::vector<std::string> columns;
+
+    void add(const snapshot_entry &entry);
+    const std::vector<snapshot_entry> &entries() const { return all; }
+    const snapshot_entry *find(const std::string &key) const;
+
+private:
+    std::vector<snapshot_entry> all;
+    std::map<std::string, int> by_key;
+};
+
+// One field of a monster that differs between two snapshots.
+struct snapshot_field_change
+{
+    std::string column;
+    std::string before;
+    std::string after;
+};
+
+struct snapshot_change
+{
+    enum change_kind
+    {
+        ADDED,
+        REMOVED,
+        CHANGED,
+    };
+
+    change_kind kind;
+    std::string key;
+    std::vector<snapshot_field_change> fields;
+};
+
+std::vector<snapshot_change> diff_snapshots(const report_snapshot &before,
+                                            const report_snapshot &after);
+std::string format_snapshot_change(const snapshot_change &change);
+
+#endif
@@ -0,0 +1,226 @@
+/**
+ * @file result_cache.cc
+ *
+ * @section DESCRIPTION
+ *
+ * The mapped result cache (see result_cache.h).
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "file_util.h"
+#include "result_cache.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Holds an flock() on a file for as long as it is in scope.
+class file_lock
+{
+public:
+    file_lock(int _fd, int operation) : fd(_fd)
+    {
+        while (flock(fd, operation) < 0 && errno == EINTR)
+            ;
+    }
+    ~file_lock() { flock(fd, LOCK_UN); }
+
+private:
+    int fd;
+};
+
+// 64-bit FNV-1a; never 0, which marks an empty slot.
+static uint64_t hash_key(const std::string &key)
+{
+    const uint64_t hash = fnv1a_hash(key.data(), key.size());
+    return hash ? hash : 1;
+}
+
+result_cache::result_cache()
+    : fd(-1), map(NULL), map_size(0), header(NULL), slots(NULL)
+{
+}
+
+result_cache::~result_cache()
+{
+    close();
+}
+
+void result_cache::close()
+{
+    if (map)
+        munmap(map, map_size);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    map = NULL;
+    map_size = 0;
+    header = NULL;
+    slots = NULL;
+}
+
+/**
+ * Open (or create) a cache file. A file that isn't a cache of this format
+ * and size, or that holds results from another crawl version, is emptied.
+ *
+ * @param path         The cache file.
+ * @param _version     The crawl version results are computed by.
+ * @return Whether the cache could be opened.
+ *
+**/
+bool result_cache::open(const std::string &path, const std::string &_version)
+{
+    close();
+    version = _version;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    map_size = sizeof(result_cache_header)
+               + (size_t) RESULT_CACHE_SLOTS * sizeof(result_cache_slot);
+
+    file_lock lock(fd, LOCK_EX);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close();
+        return false;
+    }
+
+    // The slots are left sparse until used.
+    const bool resize = st.st_size != (off_t) map_size;
+    if (resize && (ftruncate(fd, 0) < 0 || ftruncate(fd, map_size) < 0))
+    {
+        close();
+        return false;
+    }
+
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        map = NULL;
+        close();
+        return false;
+    }
+    header = static_cast<result_cache_header *>(map);
+    slots = reinterpret_cast<result_cache_slot *>(header + 1);
+
+    if (resize || !current())
+        clear();
+    return true;
+}
+
+// Is the file a cache of this format, for this crawl version?
+bool result_cache::current() const
+{
+    return header->magic == RESULT_CACHE_MAGIC
+           && header->format == RESULT_CACHE_FORMAT
+           && header->slot_count == RESULT_CACHE_SLOTS
+           && header->slot_size == sizeof(result_cache_slot)
+           && !strncmp(header->version, version.c_str(),
+                       RESULT_CACHE_VERSION_LENGTH)
+           && header->version[RESULT_CACHE_VERSION_LENGTH - 1] == 0;
+}
+
+// Empty the cache and stamp it with this version. Needs the exclusive lock.
+void result_cache::clear()
+{
+    memset(slots, 0, (size_t) RESULT_CACHE_SLOTS * sizeof(result_cache_slot));
+    memset(header, 0, sizeof *header);
+    header->magic = RESULT_CACHE_MAGIC;
+    header->format = RESULT_CACHE_FORMAT;
+    header->slot_count = RESULT_CACHE_SLOTS;
+    header->slot_size = sizeof(result_cache_slot);
+    strncpy(header->version, version.c_str(),
+            RESULT_CACHE_VERSION_LENGTH - 1);
+}
+
+/**
+ * Look a key up.
+ *
+ * @param key   The key.
+ * @param value Set to the cached value on a hit.
+ * @return Whether the key was found.
+ *
+**/
+bool result_cache::lookup(const std::string &key, std::string &value) const
+{
+    if (!map)
+        return false;
+
+    file_lock lock(fd, LOCK_SH);
+    if (!current())
+        return false;
+
+    const uint64_t hash = hash_key(key);
+    for (int probe = 0; probe < RESULT_CACHE_PROBES; ++probe)
+    {
+        const result_cache_slot &slot =
+            slots[(hash + probe) % RESULT_CACHE_SLOTS];
+        // Slots are replaced but never emptied, so an empty slot ends the
+        // run.
+        if (!slot.hash)
+            return false;
+
+        if (slot.hash == hash && slot.key_length == key.size()
+            && (uint64_t) slot.key_length + slot.value_length
+               <= sizeof slot.data
+            && !memcmp(slot.data, key.data(), key.size()))
+        {
+            value.assign(slot.data + slot.key_length, slot.value_length);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Add or replace an entry, evicting the oldest entry in the key's run of
+ * slots if they are all taken.
+ *
+ * @return Whether the entry was stored; entries too big for a slot aren't.
+ *
+**/
+bool result_cache::store(const std::string &key, const std::string &value)
+{
+    if (!map || key.size() + value.size() > sizeof slots[0].data)
+        return false;
+
+    file_lock lock(fd, LOCK_EX);
+    if (!current())
+        clear();
+
+    const uint64_t hash = hash_key(key);
+    result_cache_slot *target = NULL;
+    for (int probe = 0; probe < RESULT_CACHE_PROBES; ++probe)
+    {
+        result_cache_slot &slot = slots[(hash + probe) % RESULT_CACHE_SLOTS];
+        if (!slot.hash
+            || slot.hash == hash && slot.key_length == key.size()
+               && !memcmp(slot.data, key.data(), key.size()))
+        {
+            target = &slot;
+            break;
+        }
+        if (!target || slot.stored < target->stored)
+            target = &slot;
+    }
+
+    // Set the hash last, so that a process killed halfway through leaves
+    // an empty slot rather than a half-written entry.
+    target->hash = 0;
+    target->stored = ++header->clock;
+    target->key_length = key.size();
+    target->value_length = value.size();
+    memcpy(target->data, key.data(), key.size());
+    memcpy(target->data + key.size(), value.data(), value.size());
+    target->hash = hash;
+    return true;
+}
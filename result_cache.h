@@ -0,0 +1,88 @@
+/**
+ * @file result_cache.h
+ *
+ * @section DESCRIPTION
+ *
+ * A persistent cache of rendered reports, shared by every monster-trunk
+ * process that uses the same cache file. The file is a fixed-size
+ * open-addressing hash table, mapped into memory:
+ *
+ *     header          result_cache_header
+ *     slots           RESULT_CACHE_SLOTS result_cache_slot entries
+ *
+ * Each slot holds one key and its value. A key hashes to a run of
+ * RESULT_CACHE_PROBES slots; when they are all taken, the oldest entry in
+ * the run is replaced, so the file never grows. The whole cache is
+ * emptied when a process of another crawl version opens it.
+ *
+ * Readers take a shared lock on the file and writers an exclusive one, so
+ * any number of processes can use the cache at once.
+ *
+**/
+
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include "AppHdr.h"
+
+#include <stdint.h>
+
+#define RESULT_CACHE_MAGIC 0x4352534d // "MSRC"
+#define RESULT_CACHE_FORMAT 1
+#define RESULT_CACHE_VERSION_LENGTH 64
+#define RESULT_CACHE_SLOTS 2048
+#define RESULT_CACHE_PROBES 8
+#define RESULT_CACHE_SLOT_SIZE 4096
+
+struct result_cache_header
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    // Incremented by every store, to date entries.
+    uint64_t clock;
+    char version[RESULT_CACHE_VERSION_LENGTH];
+};
+
+struct result_cache_slot
+{
+    // 0 for an empty slot.
+    uint64_t hash;
+    uint64_t stored;
+    uint32_t key_length;
+    uint32_t value_length;
+    // The key, then the value.
+    char data[RESULT_CACHE_SLOT_SIZE - 24];
+};
+
+class result_cache
+{
+public:
+    result_cache();
+    ~result_cache();
+
+    bool open(const std::string &path, const std::string &version);
+    void close();
+
+    bool is_open() const { return map != NULL; }
+
+    bool lookup(const std::string &key, std::string &value) const;
+    bool store(const std::string &key, const std::string &value);
+
+private:
+    result_cache(const result_cache &);
+    result_cache &operator = (const result_cache &);
+
+    bool current() const;
+    void clear();
+
+    int fd;
+    void *map;
+    size_t map_size;
+    std::string version;
+    result_cache_header *header;
+    result_cache_slot *slots;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file sandbox.cc
+ *
+ * @section DESCRIPTION
+ *
+ * The dungeon grids and the unique monster and unrandart tables are plain
+ * arrays, so they are saved and restored by copying them whole. Monsters
+ * and items own heap data (names, properties, enchantments) and can't be
+ * copied like that; instead, whatever is in use at restore time is reset,
+ * which also drops monsters placed as side effects of a query (band
+ * members, summons, vault lookups).
+ *
+ * The random number generator is reseeded with a seed drawn at the
+ * checkpoint, so a query's samples don't depend on the queries before it.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "env.h"
+#include "items.h"
+#include "player.h"
+#include "random.h"
+#include "sandbox.h"
+
+static bool checkpointed = false;
+static uint32_t saved_seed;
+static decltype(env.grid) saved_grid;
+static decltype(env.mgrid) saved_mgrid;
+static decltype(env.igrid) saved_igrid;
+static decltype(you.unique_creatures) saved_unique_creatures;
+static decltype(you.unique_items) saved_unique_items;
+
+/**
+ * Save the state to restore after each query. Call once, after crawl has
+ * been initialised and the sandbox level built.
+ *
+**/
+void sandbox_checkpoint()
+{
+    saved_grid = env.grid;
+    saved_mgrid = env.mgrid;
+    saved_igrid = env.igrid;
+    saved_unique_creatures = you.unique_creatures;
+    saved_unique_items = you.unique_items;
+
+    saved_seed = random_int();
+    seed_rng(saved_seed);
+    checkpointed = true;
+}
+
+/**
+ * Undo the side effects of a query: remove every monster and item placed
+ * in the sandbox, and put the grids, uniques, unrandarts and random number
+ * generator back as they were at the checkpoint.
+ *
+**/
+void sandbox_restore()
+{
+    for (int i = 0; i < MAX_MONSTERS; ++i)
+        if (menv[i].type != MONS_NO_MONSTER)
+            menv[i].reset();
+
+    for (int i = 0; i < MAX_ITEMS; ++i)
+        if (mitm[i].defined())
+            mitm[i].clear();
+
+    if (!checkpointed)
+    {
+        you.unique_creatures.reset();
+        you.unique_items.init(UNIQ_NOT_EXISTS);
+        return;
+    }
+
+    env.grid = saved_grid;
+    env.mgrid = saved_mgrid;
+    env.igrid = saved_igrid;
+    you.unique_creatures = saved_unique_creatures;
+    you.unique_items = saved_unique_items;
+    seed_rng(saved_seed);
+}
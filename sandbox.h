@@ -0,0 +1,20 @@
+/**
+ * @file sandbox.h
+ *
+ * @section DESCRIPTION
+ *
+ * Checkpoint the crawl globals that queries modify, right after crawl is
+ * initialised, and put them back after each query, so that every query in
+ * a long-lived process starts from the same state.
+ *
+**/
+
+#ifndef __SANDBOX_H__
+#define __SANDBOX_H__
+
+#include "AppHdr.h"
+
+void sandbox_checkpoint();
+void sandbox_restore();
+
+#endif
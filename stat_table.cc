@@ -0,0 +1,754 @@
+/**
+ * @file stat_table.cc
+ *
+ * @section DESCRIPTION
+ *
+ * The table file is the columns written one after another, native-endian:
+ *
+ *     magic, format                  uint32_t each
+ *     crawl version                  STAT_TABLE_VERSION_LENGTH chars
+ *     rows                           uint32_t
+ *     names, glyphs, resistance names, flag names, size names and
+ *     intelligence names             each a uint32_t count, then for each
+ *                                    string its uint32_t length and bytes
+ *     glyph colours                  uint8_t per row
+ *     the stat columns               int32_t per row, in stat_column order
+ *     the resistance columns         int16_t per row
+ *     the flag columns               uint64_t per row
+ *     sizes, intelligences           uint8_t per row
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "file_util.h"
+#include "stat_table.h"
+#include "stringutil.h"
+
+#include <algorithm>
+
+static const char *stat_column_names[] = {
+    "hd", "hp_min", "hp_max", "ac", "ev", "xp", "speed_min", "speed_max",
+};
+
+// Players' names for resistances (rF+++ and so on), after the "r".
+static const char *resist_abbreviations[][2] = {
+    { "f", "fire" },
+    { "c", "cold" },
+    { "pois", "poison" },
+    { "n", "neg" },
+    { "corr", "acid" },
+    { "mut", "mutation" },
+};
+
+// The fields of a row, as written by stat_table_row().
+enum stat_row_field
+{
+    ROW_NAME,
+    ROW_GLYPH,
+    ROW_COLOUR,
+    ROW_STATS,
+    ROW_SIZE = ROW_STATS + NUM_STAT_COLUMNS,
+    ROW_INTELLIGENCE,
+    ROW_FLAGS,
+    ROW_RESISTS,
+    NUM_ROW_FIELDS
+};
+
+/**
+ * Flatten the stats of a report into a table row, for sending from a dump
+ * worker to the process building the table.
+ *
+**/
+std::string stat_table_row(const monster_report &rep)
+{
+    std::vector<std::string> fields(NUM_ROW_FIELDS);
+    fields[ROW_NAME] = rep.name;
+    fields[ROW_GLYPH] = rep.glyph.text;
+    fields[ROW_COLOUR] = make_stringf("%d", rep.glyph.colour);
+
+    const long stats[NUM_STAT_COLUMNS] = {
+        rep.hd, rep.hp_min, rep.hp_max, rep.ac, rep.ev, rep.xp,
+        rep.speed_min, rep.speed_max,
+    };
+    for (int i = 0; i < NUM_STAT_COLUMNS; ++i)
+        fields[ROW_STATS + i] = make_stringf("%ld", stats[i]);
+
+    fields[ROW_SIZE] = rep.size;
+    fields[ROW_INTELLIGENCE] = rep.intelligence;
+
+    for (unsigned int i = 0; i < rep.flags.size(); ++i)
+    {
+        if (i)
+            fields[ROW_FLAGS] += ",";
+        fields[ROW_FLAGS] += rep.flags[i].text;
+    }
+
+    for (unsigned int i = 0; i < rep.resists.size(); ++i)
+    {
+        const report_resist &resist = rep.resists[i];
+        int level = resist.level;
+        if (!resist.detail.empty())
+        {
+            level = resist.detail == "immune" ? STAT_MR_IMMUNE
+                                              : atoi(resist.detail.c_str());
+        }
+        if (i)
+            fields[ROW_RESISTS] += ",";
+        fields[ROW_RESISTS] += make_stringf("%s=%d", resist.name.c_str(),
+                                            level);
+    }
+
+    std::string row;
+    for (unsigned int i = 0; i < fields.size(); ++i)
+    {
+        if (i)
+            row += "\t";
+        row += fields[i];
+    }
+    return row;
+}
+
+stat_table::stat_table()
+{
+}
+
+static int dictionary_index(std::vector<std::string> &dictionary,
+                            const std::string &name)
+{
+    std::vector<std::string>::iterator found =
+        std::find(dictionary.begin(), dictionary.end(), name);
+    if (found != dictionary.end())
+        return found - dictionary.begin();
+    dictionary.push_back(name);
+    return dictionary.size() - 1;
+}
+
+int stat_table::resist_index(const std::string &name, bool add)
+{
+    const int index = find_resist(name);
+    if (index >= 0 || !add)
+        return index;
+
+    resist_names.push_back(name);
+    resists.push_back(std::vector<int16_t>(size(), 0));
+    return resist_names.size() - 1;
+}
+
+int stat_table::flag_index(const std::string &name, bool add)
+{
+    const int index = find_flag(name);
+    if (index >= 0 || !add)
+        return index;
+
+    flag_names.push_back(name);
+    if (flags.size() * 64 < flag_names.size())
+        flags.push_back(std::vector<uint64_t>(size(), 0));
+    return flag_names.size() - 1;
+}
+
+int stat_table::find_resist(const std::string &name) const
+{
+    for (unsigned int i = 0; i < resist_names.size(); ++i)
+        if (resist_names[i] == name)
+            return i;
+    return -1;
+}
+
+int stat_table::find_flag(const std::string &name) const
+{
+    for (unsigned int i = 0; i < flag_names.size(); ++i)
+        if (flag_names[i] == name)
+            return i;
+    return -1;
+}
+
+/**
+ * Add a row made by stat_table_row().
+ *
+ * @return Whether the row was well-formed.
+ *
+**/
+bool stat_table::add_row(const std::string &row)
+{
+    const std::vector<std::string> fields =
+        split_string("\t", row, false, true);
+    if (fields.size() != NUM_ROW_FIELDS || size() >= 255 * 255 * 255)
+        return false;
+
+    names.push_back(fields[ROW_NAME]);
+    glyphs.push_back(fields[ROW_GLYPH]);
+    glyph_colours.push_back(atoi(fields[ROW_COLOUR].c_str()));
+    for (int i = 0; i < NUM_STAT_COLUMNS; ++i)
+        columns[i].push_back(atoi(fields[ROW_STATS + i].c_str()));
+
+    sizes.push_back(dictionary_index(size_names, fields[ROW_SIZE]));
+    intelligences.push_back(dictionary_index(intelligence_names,
+                                             fields[ROW_INTELLIGENCE]));
+
+    for (unsigned int i = 0; i < resists.size(); ++i)
+        resists[i].push_back(0);
+    for (unsigned int i = 0; i < flags.size(); ++i)
+        flags[i].push_back(0);
+
+    const std::vector<std::string> row_flags =
+        split_string(",", fields[ROW_FLAGS], false, false);
+    for (unsigned int i = 0; i < row_flags.size(); ++i)
+    {
+        const int flag = flag_index(row_flags[i], true);
+        flags[flag / 64].back() |= 1ULL << (flag % 64);
+    }
+
+    const std::vector<std::string> row_resists =
+        split_string(",", fields[ROW_RESISTS], false, false);
+    for (unsigned int i = 0; i < row_resists.size(); ++i)
+    {
+        const std::string::size_type eq = row_resists[i].find('=');
+        if (eq == std::string::npos)
+            continue;
+        const int resist = resist_index(row_resists[i].substr(0, eq), true);
+        resists[resist].back() = atoi(row_resists[i].c_str() + eq + 1);
+    }
+    return true;
+}
+
+static void put_u32(std::string &out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+static void put_strings(std::string &out,
+                        const std::vector<std::string> &strings)
+{
+    put_u32(out, strings.size());
+    for (unsigned int i = 0; i < strings.size(); ++i)
+    {
+        put_u32(out, strings[i].size());
+        out += strings[i];
+    }
+}
+
+template <typename T>
+static void put_column(std::string &out, const std::vector<T> &column)
+{
+    if (!column.empty())
+    {
+        out.append(reinterpret_cast<const char *>(&column[0]),
+                   column.size() * sizeof(T));
+    }
+}
+
+/**
+ * Write the table, under a temporary name renamed into place.
+ *
+ * @param filename The file to (re)write.
+ * @param version  The crawl version to record.
+ * @return Whether the table was written.
+ *
+**/
+bool stat_table::write(const std::string &filename,
+                       const std::string &version) const
+{
+    std::string out;
+    put_u32(out, STAT_TABLE_MAGIC);
+    put_u32(out, STAT_TABLE_FORMAT);
+    char version_buf[STAT_TABLE_VERSION_LENGTH];
+    memset(version_buf, 0, sizeof version_buf);
+    strncpy(version_buf, version.c_str(), sizeof version_buf - 1);
+    out.append(version_buf, sizeof version_buf);
+    put_u32(out, size());
+
+    put_strings(out, names);
+    put_strings(out, glyphs);
+    put_strings(out, resist_names);
+    put_strings(out, flag_names);
+    put_strings(out, size_names);
+    put_strings(out, intelligence_names);
+
+    put_column(out, glyph_colours);
+    for (int i = 0; i < NUM_STAT_COLUMNS; ++i)
+        put_column(out, columns[i]);
+    for (unsigned int i = 0; i < resists.size(); ++i)
+        put_column(out, resists[i]);
+    for (unsigned int i = 0; i < flags.size(); ++i)
+        put_column(out, flags[i]);
+    put_column(out, sizes);
+    put_column(out, intelligences);
+
+    return write_file_atomically(filename, [&](FILE *file)
+    {
+        fwrite(out.data(), 1, out.size(), file);
+    });
+}
+
+// Reads the table file, checking every read against the end of the data.
+class table_reader
+{
+public:
+    table_reader(const std::string &_data) : data(_data), pos(0), ok(true)
+    {
+    }
+
+    bool good() const { return ok; }
+    bool at_end() const { return pos == data.size(); }
+
+    bool read(void *buf, size_t size)
+    {
+        if (!ok || size > data.size() - pos)
+            return ok = false;
+        memcpy(buf, data.data() + pos, size);
+        pos += size;
+        return true;
+    }
+
+    uint32_t u32()
+    {
+        uint32_t value = 0;
+        read(&value, sizeof value);
+        return value;
+    }
+
+    void strings(std::vector<std::string> &out)
+    {
+        const uint32_t count = u32();
+        if (count > data.size())
+        {
+            ok = false;
+            return;
+        }
+        out.resize(count);
+        for (uint32_t i = 0; i < count && ok; ++i)
+        {
+            const uint32_t length = u32();
+            if (!ok || length > data.size() - pos)
+            {
+                ok = false;
+                return;
+            }
+            out[i] = data.substr(pos, length);
+            pos += length;
+        }
+    }
+
+    template <typename T>
+    void column(std::vector<T> &out, uint32_t rows)
+    {
+        if ((uint64_t) rows * sizeof(T) > data.size() - pos)
+        {
+            ok = false;
+            return;
+        }
+        out.resize(rows);
+        if (rows)
+            read(&out[0], rows * sizeof(T));
+    }
+
+private:
+    const std::string &data;
+    size_t pos;
+    bool ok;
+};
+
+/**
+ * Load a table written by write(), replacing this one.
+ *
+ * @return Whether the file could be read and is a valid table.
+ *
+**/
+bool stat_table::load(const std::string &filename)
+{
+    *this = stat_table();
+
+    std::string data;
+    if (!read_file(filename, data))
+        return false;
+
+    table_reader in(data);
+    char version_buf[STAT_TABLE_VERSION_LENGTH];
+    if (in.u32() != STAT_TABLE_MAGIC || in.u32() != STAT_TABLE_FORMAT
+        || !in.read(version_buf, sizeof version_buf)
+        || version_buf[STAT_TABLE_VERSION_LENGTH - 1])
+    {
+        return false;
+    }
+    const uint32_t rows = in.u32();
+
+    in.strings(names);
+    in.strings(glyphs);
+    in.strings(resist_names);
+    in.strings(flag_names);
+    in.strings(size_names);
+    in.strings(intelligence_names);
+    if (!in.good() || names.size() != rows || glyphs.size() != rows)
+    {
+        *this = stat_table();
+        return false;
+    }
+
+    in.column(glyph_colours, rows);
+    for (int i = 0; i < NUM_STAT_COLUMNS; ++i)
+        in.column(columns[i], rows);
+    resists.resize(resist_names.size());
+    for (unsigned int i = 0; i < resists.size(); ++i)
+        in.column(resists[i], rows);
+    flags.resize((flag_names.size() + 63) / 64);
+    for (unsigned int i = 0; i < flags.size(); ++i)
+        in.column(flags[i], rows);
+    in.column(sizes, rows);
+    in.column(intelligences, rows);
+
+    bool valid = in.good() && in.at_end();
+    for (uint32_t i = 0; valid && i < rows; ++i)
+    {
+        valid = sizes[i] < size_names.size()
+                && intelligences[i] < intelligence_names.size();
+    }
+    if (!valid)
+    {
+        *this = stat_table();
+        return false;
+    }
+
+    table_version = version_buf;
+    return true;
+}
+
+/**
+ * Resolve a column name: a stat (hd, xp, ...; hp and speed mean the
+ * maximum), a resistance by name or as rF-style shorthand, or mr for
+ * magic resistance.
+ *
+**/
+bool stat_table::parse_key(const std::string &key,
+                           stat_predicate::predicate_kind &kind,
+                           int &column) const
+{
+    const std::string name = lowercase_string(key);
+
+    kind = stat_predicate::NUMBER;
+    for (int i = 0; i < NUM_STAT_COLUMNS; ++i)
+    {
+        if (name == stat_column_names[i])
+        {
+            column = i;
+            return true;
+        }
+    }
+    if (name == "hp" || name == "speed")
+    {
+        column = name == "hp" ? STAT_HP_MAX : STAT_SPEED_MAX;
+        return true;
+    }
+
+    kind = stat_predicate::RESIST;
+    std::string resist = name == "mr" ? "magic" : name;
+    if (find_resist(resist) < 0 && resist.size() > 1 && resist[0] == 'r')
+    {
+        resist = resist.substr(1);
+        for (unsigned int i = 0; i < ARRAYSZ(resist_abbreviations); ++i)
+            if (resist == resist_abbreviations[i][0])
+                resist = resist_abbreviations[i][1];
+    }
+    column = find_resist(resist);
+    return column >= 0;
+}
+
+static bool parse_int(const std::string &text, int &value)
+{
+    char *end;
+    const long parsed = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end)
+        return false;
+    value = parsed;
+    return true;
+}
+
+/**
+ * Parse a --where expression: terms separated by spaces, all of which must
+ * hold. A term is one of:
+ *
+ *   key<op>number   a stat or resistance; op is <, <=, =, !=, >= or >
+ *   rF+++ / rF-     resistance at least / vulnerability at most this level
+ *   flag            the monster has a flag (fly, see_invisible, undead...)
+ *   !flag           it doesn't
+ *   size=S, int=I, glyph=G (or !=)
+ *
+**/
+bool stat_table::parse_where(const std::string &expr,
+                             std::vector<stat_predicate> &predicates,
+                             std::string &error) const
+{
+    const std::vector<std::string> terms =
+        split_string(" ", expr, true, false);
+    for (unsigned int i = 0; i < terms.size(); ++i)
+    {
+        const std::string &term = terms[i];
+        stat_predicate pred;
+        pred.value = 0;
+
+        const std::string::size_type op_pos = term.find_first_of("<>=!", 1);
+        const std::string::size_type signs = term.find_first_of("+-");
+        if (op_pos != std::string::npos)
+        {
+            const std::string key = lowercase_string(term.substr(0, op_pos));
+            std::string::size_type value_pos = op_pos + 1;
+            const char c = term[op_pos];
+            const bool eq = value_pos < term.size() && term[value_pos] == '=';
+            if (eq)
+                ++value_pos;
+            if (c == '<')
+                pred.op = eq ? STAT_LE : STAT_LT;
+            else if (c == '>')
+                pred.op = eq ? STAT_GE : STAT_GT;
+            else if (c == '!' && eq)
+                pred.op = STAT_NE;
+            else if (c == '=')
+                pred.op = STAT_EQ;
+            else
+            {
+                error = "bad comparison in: " + term;
+                return false;
+            }
+            const std::string value = term.substr(value_pos);
+
+            if (key == "size" || key == "int" || key == "intelligence"
+                || key == "glyph")
+            {
+                if (pred.op != STAT_EQ && pred.op != STAT_NE)
+                {
+                    error = key + " can only be compared with = or !=";
+                    return false;
+                }
+                const std::vector<std::string> &dictionary =
+                    key == "size" ? size_names
+                    : key == "glyph" ? glyphs : intelligence_names;
+                pred.kind = key == "size" ? stat_predicate::SIZE
+                            : key == "glyph" ? stat_predicate::GLYPH
+                            : stat_predicate::INTELLIGENCE;
+                pred.column = 0;
+                // Not found matches nothing (or, for !=, everything).
+                pred.value = -1;
+                for (unsigned int j = 0; j < dictionary.size(); ++j)
+                {
+                    if (key == "glyph" ? dictionary[j] == value
+                                       : lowercase_string(dictionary[j])
+                                         == lowercase_string(value))
+                    {
+                        pred.value = j;
+                        break;
+                    }
+                }
+            }
+            else if (!parse_key(key, pred.kind, pred.column))
+            {
+                error = "unknown column: " + key;
+                return false;
+            }
+            else if (!parse_int(value, pred.value))
+            {
+                error = "not a number in: " + term;
+                return false;
+            }
+        }
+        else if (term.size() > 1 && term[0] == 'r' && signs != std::string::npos
+                 && term.find_first_not_of(term[signs], signs)
+                    == std::string::npos)
+        {
+            if (!parse_key(term.substr(0, signs), pred.kind, pred.column))
+            {
+                error = "unknown resistance: " + term.substr(0, signs);
+                return false;
+            }
+            const int level = term.size() - signs;
+            pred.op = term[signs] == '+' ? STAT_GE : STAT_LE;
+            pred.value = term[signs] == '+' ? level : -level;
+        }
+        else
+        {
+            const bool negated = term[0] == '!';
+            const std::string flag =
+                replace_all(term.substr(negated ? 1 : 0), "_", " ");
+            pred.kind = stat_predicate::FLAG;
+            pred.op = STAT_EQ;
+            pred.column = find_flag(lowercase_string(flag));
+            pred.value = !negated;
+            if (pred.column < 0)
+            {
+                error = "unknown flag: " + flag;
+                return false;
+            }
+        }
+        predicates.push_back(pred);
+    }
+    return true;
+}
+
+/**
+ * Parse a ranking key: a column name (see parse_key()) or two separated
+ * by a slash, e.g. xp/hp_max.
+ *
+**/
+bool stat_table::parse_order(const std::string &key, stat_order &order,
+                             std::string &error) const
+{
+    order.name = key;
+    const std::string::size_type slash = key.find('/');
+    order.ratio = slash != std::string::npos;
+    if (!parse_key(key.substr(0, slash), order.kind, order.column))
+    {
+        error = "unknown column: " + key.substr(0, slash);
+        return false;
+    }
+    if (order.ratio
+        && !parse_key(key.substr(slash + 1), order.divisor_kind,
+                      order.divisor))
+    {
+        error = "unknown column: " + key.substr(slash + 1);
+        return false;
+    }
+    return true;
+}
+
+int stat_table::key_value(stat_predicate::predicate_kind kind, int column,
+                          int row) const
+{
+    return kind == stat_predicate::NUMBER ? columns[column][row]
+                                          : resists[column][row];
+}
+
+template <typename T>
+static void filter_column(const std::vector<T> &column, stat_op op,
+                          int value, std::vector<uint8_t> &keep)
+{
+    const size_t n = column.size();
+    switch (op)
+    {
+    case STAT_LT:
+        for (size_t i = 0; i < n; ++i)
+            keep[i] &= column[i] < value;
+        break;
+    case STAT_LE:
+        for (size_t i = 0; i < n; ++i)
+            keep[i] &= column[i] <= value;
+        break;
+    case STAT_EQ:
+        for (size_t i = 0; i < n; ++i)
+            keep[i] &= column[i] == value;
+        break;
+    case STAT_NE:
+        for (size_t i = 0; i < n; ++i)
+            keep[i] &= column[i] != value;
+        break;
+    case STAT_GE:
+        for (size_t i = 0; i < n; ++i)
+            keep[i] &= column[i] >= value;
+        break;
+    case STAT_GT:
+        for (size_t i = 0; i < n; ++i)
+            keep[i] &= column[i] > value;
+        break;
+    }
+}
+
+/**
+ * The rows matching every predicate, in table order.
+ *
+**/
+std::vector<int> stat_table::select(
+    const std::vector<stat_predicate> &predicates) const
+{
+    const size_t n = size();
+    std::vector<uint8_t> keep(n, 1);
+
+    for (unsigned int p = 0; p < predicates.size(); ++p)
+    {
+        const stat_predicate &pred = predicates[p];
+        switch (pred.kind)
+        {
+        case stat_predicate::NUMBER:
+            filter_column(columns[pred.column], pred.op, pred.value, keep);
+            break;
+        case stat_predicate::RESIST:
+            filter_column(resists[pred.column], pred.op, pred.value, keep);
+            break;
+        case stat_predicate::SIZE:
+            filter_column(sizes, pred.op, pred.value, keep);
+            break;
+        case stat_predicate::INTELLIGENCE:
+            filter_column(intelligences, pred.op, pred.value, keep);
+            break;
+        case stat_predicate::GLYPH:
+            for (size_t i = 0; i < n; ++i)
+            {
+                keep[i] &= (pred.value >= 0 && glyphs[i] == glyphs[pred.value])
+                           == (pred.op == STAT_EQ);
+            }
+            break;
+        case stat_predicate::FLAG:
+        {
+            const std::vector<uint64_t> &word = flags[pred.column / 64];
+            const uint64_t bit = 1ULL << (pred.column % 64);
+            const uint64_t want = pred.value ? bit : 0;
+            for (size_t i = 0; i < n; ++i)
+                keep[i] &= (word[i] & bit) == want;
+            break;
+        }
+        }
+    }
+
+    std::vector<int> rows;
+    for (size_t i = 0; i < n; ++i)
+        if (keep[i])
+            rows.push_back(i);
+    return rows;
+}
+
+double stat_table::order_value(int row, const stat_order &order) const
+{
+    const double value = key_value(order.kind, order.column, row);
+    if (!order.ratio)
+        return value;
+    const int divisor = key_value(order.divisor_kind, order.divisor, row);
+    return divisor ? value / divisor : 0;
+}
+
+/**
+ * Sort rows by order, highest first (ties by name), keeping only the
+ * first top rows if top is non-zero.
+ *
+**/
+void stat_table::rank(std::vector<int> &rows, const stat_order &order,
+                      unsigned int top) const
+{
+    std::vector<double> keys(size());
+    for (unsigned int i = 0; i < rows.size(); ++i)
+        keys[rows[i]] = order_value(rows[i], order);
+
+    auto higher = [&](int a, int b)
+    {
+        return keys[a] != keys[b] ? keys[a] > keys[b] : names[a] < names[b];
+    };
+    if (top && top < rows.size())
+    {
+        std::partial_sort(rows.begin(), rows.begin() + top, rows.end(),
+                          higher);
+        rows.resize(top);
+    }
+    else
+        std::sort(rows.begin(), rows.end(), higher);
+}
+
+std::string stat_table::describe(int row) const
+{
+    const int speed_min = columns[STAT_SPEED_MIN][row];
+    const int speed_max = columns[STAT_SPEED_MAX][row];
+    return make_stringf("%s (%s) | Spd: %s | HD: %d | HP: %d-%d | AC/EV: %d/%d"
+                        " | XP: %d",
+                        names[row].c_str(), glyphs[row].c_str(),
+                        speed_min == speed_max
+                        ? make_stringf("%d", speed_min).c_str()
+                        : make_stringf("%d-%d", speed_min, speed_max).c_str(),
+                        columns[STAT_HD][row], columns[STAT_HP_MIN][row],
+                        columns[STAT_HP_MAX][row], columns[STAT_AC][row],
+                        columns[STAT_EV][row], columns[STAT_XP][row]);
+}
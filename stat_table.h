@@ -0,0 +1,146 @@
+/**
+ * @file stat_table.h
+ *
+ * @section DESCRIPTION
+ *
+ * Every monster's stats in one table, stored column by column, for
+ * questions about the whole bestiary ("rF+++ and HD >= 15", "top 10 by
+ * XP/HP") that would otherwise mean querying every monster in turn.
+ *
+ * The table is built once by monster-trunk --export-table and then loaded
+ * and queried without initialising crawl. Each filter is a single pass over
+ * one column.
+ *
+**/
+
+#ifndef __STAT_TABLE_H__
+#define __STAT_TABLE_H__
+
+#include "AppHdr.h"
+
+#include "monster_report.h"
+
+#include <stdint.h>
+
+#define STAT_TABLE_MAGIC 0x4254534d // "MSTB"
+#define STAT_TABLE_FORMAT 1
+#define STAT_TABLE_VERSION_LENGTH 64
+
+enum stat_column
+{
+    STAT_HD,
+    STAT_HP_MIN,
+    STAT_HP_MAX,
+    STAT_AC,
+    STAT_EV,
+    STAT_XP,
+    STAT_SPEED_MIN,
+    STAT_SPEED_MAX,
+    NUM_STAT_COLUMNS
+};
+
+// The magic resistance of monsters immune to magic.
+#define STAT_MR_IMMUNE 5000
+
+enum stat_op
+{
+    STAT_LT,
+    STAT_LE,
+    STAT_EQ,
+    STAT_NE,
+    STAT_GE,
+    STAT_GT,
+};
+
+// One term of a --where expression.
+struct stat_predicate
+{
+    enum predicate_kind
+    {
+        NUMBER,     // a stat_column
+        RESIST,     // a resistance level (or magic resistance)
+        FLAG,       // has (or, if value is 0, lacks) a flag
+        SIZE,       // has a size
+        INTELLIGENCE,
+        GLYPH,
+    };
+
+    predicate_kind kind;
+    int column;
+    stat_op op;
+    int value;
+};
+
+// A ranking key: a column, or the ratio of two (e.g. xp/hp_max).
+struct stat_order
+{
+    stat_predicate::predicate_kind kind;
+    int column;
+    bool ratio;
+    stat_predicate::predicate_kind divisor_kind;
+    int divisor;
+    std::string name;
+};
+
+class stat_table
+{
+public:
+    stat_table();
+
+    bool add_row(const std::string &row);
+    int size() const { return names.size(); }
+
+    bool write(const std::string &filename, const std::string &version) const;
+    bool load(const std::string &filename);
+    const std::string &version() const { return table_version; }
+
+    bool parse_where(const std::string &expr,
+                     std::vector<stat_predicate> &predicates,
+                     std::string &error) const;
+    bool parse_order(const std::string &key, stat_order &order,
+                     std::string &error) const;
+
+    std::vector<int> select(const std::vector<stat_predicate> &predicates)
+        const;
+    void rank(std::vector<int> &rows, const stat_order &order,
+              unsigned int top) const;
+    double order_value(int row, const stat_order &order) const;
+
+    std::string describe(int row) const;
+
+private:
+    std::vector<std::string> names;
+    std::vector<std::string> glyphs;
+    std::vector<uint8_t> glyph_colours;
+    std::vector<int32_t> columns[NUM_STAT_COLUMNS];
+
+    // One column of levels per resistance; 0 where a monster has none.
+    std::vector<std::string> resist_names;
+    std::vector<std::vector<int16_t> > resists;
+
+    // Flags are a bitset per monster, stored as one column per 64 flags.
+    std::vector<std::string> flag_names;
+    std::vector<std::vector<uint64_t> > flags;
+
+    // Sizes and intelligences are small enumerations, stored as indices
+    // into their names.
+    std::vector<std::string> size_names;
+    std::vector<uint8_t> sizes;
+    std::vector<std::string> intelligence_names;
+    std::vector<uint8_t> intelligences;
+
+    std::string table_version;
+
+    int resist_index(const std::string &name, bool add);
+    int flag_index(const std::string &name, bool add);
+    int find_resist(const std::string &name) const;
+    int find_flag(const std::string &name) const;
+    bool parse_key(const std::string &name,
+                   stat_predicate::predicate_kind &kind, int &column) const;
+    int key_value(stat_predicate::predicate_kind kind, int column,
+                  int row) const;
+};
+
+std::string stat_table_row(const monster_report &report);
+
+#endif
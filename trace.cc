@@ -0,0 +1,250 @@
+/**
+ * @file trace.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Each span is written to the trace file as one complete ("X") event as
+ * soon as it ends, with a single append-mode write. Forked workers inherit
+ * the file and write their own spans to it, under their own pid, so the
+ * trace covers them too. The file uses Chrome's JSON array format, which
+ * allows the closing bracket to be left off; that way a trace is valid
+ * however the process ends.
+ *
+ * If the query alarm kills the process, the spans that were still open are
+ * written out, marked unfinished, before it dies, so that a trace shows
+ * where a runaway query was stuck.
+ *
+ * Where perf events are available, spans also record CPU cycles,
+ * instructions and cache misses in user space.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "trace.h"
+
+#ifdef MONSTER_TRACE
+
+#include <csignal>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#define MAX_OPEN_SPANS 64
+#define NUM_COUNTERS 3
+
+static int trace_fd = -1;
+static int counter_fds[NUM_COUNTERS] = { -1, -1, -1 };
+
+struct open_span
+{
+    const char *name;
+    double start;
+    trace_counters counters;
+};
+
+// Spans that haven't ended yet, outermost first.
+static open_span open_spans[MAX_OPEN_SPANS];
+static int open_span_count = 0;
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void close_counters()
+{
+    for (int i = 0; i < NUM_COUNTERS; ++i)
+    {
+        if (counter_fds[i] >= 0)
+            close(counter_fds[i]);
+        counter_fds[i] = -1;
+    }
+}
+
+#ifdef __linux__
+static int open_counter(uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+// Counters are per process, so forked children open their own.
+static void open_counters()
+{
+    close_counters();
+#ifdef __linux__
+    counter_fds[0] = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (counter_fds[0] < 0)
+        return;
+    counter_fds[1] = open_counter(PERF_COUNT_HW_INSTRUCTIONS, counter_fds[0]);
+    counter_fds[2] = open_counter(PERF_COUNT_HW_CACHE_MISSES, counter_fds[0]);
+    if (counter_fds[1] < 0 || counter_fds[2] < 0)
+    {
+        close_counters();
+        return;
+    }
+    ioctl(counter_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counter_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+static trace_counters read_counters()
+{
+    trace_counters counters;
+    memset(&counters, 0, sizeof counters);
+    if (counter_fds[0] < 0)
+        return counters;
+
+    // The number of counters, then each counter's value.
+    uint64_t values[NUM_COUNTERS + 1];
+    if (read(counter_fds[0], values, sizeof values) != sizeof values
+        || values[0] != NUM_COUNTERS)
+    {
+        return counters;
+    }
+
+    counters.valid = true;
+    counters.cycles = values[1];
+    counters.instructions = values[2];
+    counters.cache_misses = values[3];
+    return counters;
+}
+
+// Also called from the alarm handler, so it formats into a local buffer
+// and writes it in one go.
+static void write_event(const char *name, double start, double end,
+                        const trace_counters &before,
+                        const trace_counters &after, bool unfinished)
+{
+    char buf[512];
+    int len = snprintf(buf, sizeof buf,
+                       "{\"name\":\"%s\",\"cat\":\"monster\",\"ph\":\"X\","
+                       "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                       "\"args\":{",
+                       name, start, end - start, (int) getpid(),
+                       (int) getpid());
+    const char *sep = "";
+    if (before.valid && after.valid)
+    {
+        len += snprintf(buf + len, sizeof buf - len,
+                        "\"cycles\":%llu,\"instructions\":%llu,"
+                        "\"cache_misses\":%llu",
+                        (unsigned long long) (after.cycles - before.cycles),
+                        (unsigned long long) (after.instructions
+                                              - before.instructions),
+                        (unsigned long long) (after.cache_misses
+                                              - before.cache_misses));
+        sep = ",";
+    }
+    if (unfinished)
+        len += snprintf(buf + len, sizeof buf - len, "%s\"unfinished\":true",
+                        sep);
+    len += snprintf(buf + len, sizeof buf - len, "}},\n");
+
+    if (len > 0 && len < (int) sizeof buf)
+    {
+        const ssize_t written = write(trace_fd, buf, len);
+        (void) written;
+    }
+}
+
+static void trace_alarm(int sig)
+{
+    const double now = now_us();
+    const trace_counters counters = read_counters();
+    for (int i = std::min(open_span_count, MAX_OPEN_SPANS) - 1; i >= 0; --i)
+    {
+        write_event(open_spans[i].name, open_spans[i].start, now,
+                    open_spans[i].counters, counters, true);
+    }
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// The parent's open spans end in the parent, not in a forked child.
+static void trace_forked_child()
+{
+    open_span_count = 0;
+    open_counters();
+}
+
+/**
+ * Start writing spans to filename.
+ *
+ * @return Whether the file could be created.
+**/
+bool trace_open(const std::string &filename)
+{
+    trace_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                    0644);
+    if (trace_fd < 0)
+        return false;
+
+    if (write(trace_fd, "[\n", 2) != 2)
+    {
+        close(trace_fd);
+        trace_fd = -1;
+        return false;
+    }
+
+    open_counters();
+    pthread_atfork(0, 0, trace_forked_child);
+    signal(SIGALRM, trace_alarm);
+    return true;
+}
+
+trace_span::trace_span(const char *_name)
+    : name(_name), start(0), depth(0), open(trace_fd >= 0)
+{
+    if (!open)
+        return;
+
+    counters = read_counters();
+    start = now_us();
+
+    depth = open_span_count++;
+    if (depth < MAX_OPEN_SPANS)
+    {
+        open_spans[depth].name = name;
+        open_spans[depth].start = start;
+        open_spans[depth].counters = counters;
+    }
+}
+
+trace_span::~trace_span()
+{
+    end();
+}
+
+void trace_span::end()
+{
+    if (!open)
+        return;
+    open = false;
+
+    const double finish = now_us();
+    write_event(name, start, finish, counters, read_counters(), false);
+    open_span_count = depth;
+}
+
+#endif
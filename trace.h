@@ -0,0 +1,66 @@
+/**
+ * @file trace.h
+ *
+ * @section DESCRIPTION
+ *
+ * Timing spans written as Chrome trace events (load the file in
+ * chrome://tracing or Perfetto). Spans are only compiled in when
+ * MONSTER_TRACE is defined (make TRACE=y); otherwise the macros expand to
+ * nothing and cost nothing.
+ *
+ *   TRACE_SPAN(span, "name");   // starts a span, ended at end of scope
+ *   TRACE_END(span);            // or ends it early
+ *
+**/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "AppHdr.h"
+
+#ifdef MONSTER_TRACE
+
+#include <stdint.h>
+
+// Hardware counter readings; valid is false if perf events aren't
+// available (no permission, or not Linux).
+struct trace_counters
+{
+    bool valid;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t cache_misses;
+};
+
+class trace_span
+{
+public:
+    explicit trace_span(const char *name);
+    ~trace_span();
+
+    void end();
+
+private:
+    const char *name;
+    double start;
+    trace_counters counters;
+    int depth;
+    bool open;
+
+    trace_span(const trace_span &);
+    trace_span &operator = (const trace_span &);
+};
+
+bool trace_open(const std::string &filename);
+
+#define TRACE_SPAN(var, name) trace_span var(name)
+#define TRACE_END(var) var.end()
+
+#else
+
+#define TRACE_SPAN(var, name) ((void) 0)
+#define TRACE_END(var) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @file value_sketch.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Streaming stat summaries (see value_sketch.h).
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "value_sketch.h"
+#include "stringutil.h"
+
+#include <cmath>
+
+// Division rounding towards minus infinity, so that buckets of negative
+// values are as wide as the rest.
+static long floor_div(long value, long divisor)
+{
+    const long quotient = value / divisor;
+    return quotient * divisor > value ? quotient - 1 : quotient;
+}
+
+value_sketch::value_sketch()
+    : n(0), sum(0), sum_sq(0), lo(0), hi(0), width(1)
+{
+}
+
+void value_sketch::add(long value)
+{
+    if (!n || value < lo)
+        lo = value;
+    if (!n || value > hi)
+        hi = value;
+    ++n;
+    sum += value;
+    sum_sq += (double) value * value;
+
+    ++buckets[floor_div(value, width)];
+    if (buckets.size() > VALUE_SKETCH_MAX_BUCKETS)
+        rebucket(width * 2);
+}
+
+// Widen the buckets to new_width (a multiple of the current width), and
+// keep widening until there are few enough.
+void value_sketch::rebucket(long new_width)
+{
+    do
+    {
+        std::map<long, long> merged;
+        for (std::map<long, long>::const_iterator i = buckets.begin();
+             i != buckets.end(); ++i)
+        {
+            merged[floor_div(i->first * width, new_width)] += i->second;
+        }
+        buckets.swap(merged);
+        width = new_width;
+        new_width *= 2;
+    }
+    while (buckets.size() > VALUE_SKETCH_MAX_BUCKETS);
+}
+
+void value_sketch::merge(const value_sketch &other)
+{
+    if (!other.n)
+        return;
+
+    if (!n || other.lo < lo)
+        lo = other.lo;
+    if (!n || other.hi > hi)
+        hi = other.hi;
+    n += other.n;
+    sum += other.sum;
+    sum_sq += other.sum_sq;
+
+    // Widths are both powers of two, so the narrower buckets fit exactly
+    // into the wider ones.
+    if (other.width > width)
+        rebucket(other.width);
+    for (std::map<long, long>::const_iterator i = other.buckets.begin();
+         i != other.buckets.end(); ++i)
+    {
+        buckets[floor_div(i->first * other.width, width)] += i->second;
+    }
+    if (buckets.size() > VALUE_SKETCH_MAX_BUCKETS)
+        rebucket(width * 2);
+}
+
+double value_sketch::mean() const
+{
+    return n ? sum / n : 0;
+}
+
+double value_sketch::stddev() const
+{
+    if (!n)
+        return 0;
+    const double m = mean();
+    return sqrt(std::max(0.0, sum_sq / n - m * m));
+}
+
+/**
+ * The value below which a fraction q of the values fall: exact while the
+ * histogram is, otherwise the middle of the bucket it falls in.
+ *
+**/
+long value_sketch::quantile(double q) const
+{
+    if (!n)
+        return 0;
+
+    const long rank = std::max(1L, (long) ceil(q * n));
+    long seen = 0;
+    for (std::map<long, long>::const_iterator i = buckets.begin();
+         i != buckets.end(); ++i)
+    {
+        seen += i->second;
+        if (seen >= rank)
+        {
+            const long value = i->first * width + (width - 1) / 2;
+            return std::min(hi, std::max(lo, value));
+        }
+    }
+    return hi;
+}
+
+// One line: the totals, then the buckets as key:count pairs.
+std::string value_sketch::serialise() const
+{
+    std::string out = make_stringf("%ld %.17g %.17g %ld %ld %ld", n, sum,
+                                   sum_sq, lo, hi, width);
+    for (std::map<long, long>::const_iterator i = buckets.begin();
+         i != buckets.end(); ++i)
+    {
+        out += make_stringf(" %ld:%ld", i->first, i->second);
+    }
+    return out;
+}
+
+bool value_sketch::deserialise(const std::string &data)
+{
+    *this = value_sketch();
+
+    const std::vector<std::string> parts = split_string(" ", data, false);
+    if (parts.size() < 6
+        || sscanf(data.c_str(), "%ld %lf %lf %ld %ld %ld", &n, &sum, &sum_sq,
+                  &lo, &hi, &width) != 6
+        || width < 1 || (width & (width - 1)))
+    {
+        *this = value_sketch();
+        return false;
+    }
+
+    long total = 0;
+    for (unsigned int i = 6; i < parts.size(); ++i)
+    {
+        long key, count;
+        if (sscanf(parts[i].c_str(), "%ld:%ld", &key, &count) != 2
+            || count < 1)
+        {
+            *this = value_sketch();
+            return false;
+        }
+        buckets[key] += count;
+        total += count;
+    }
+    if (total != n || buckets.size() > VALUE_SKETCH_MAX_BUCKETS)
+    {
+        *this = value_sketch();
+        return false;
+    }
+    return true;
+}
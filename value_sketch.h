@@ -0,0 +1,56 @@
+/**
+ * @file value_sketch.h
+ *
+ * @section DESCRIPTION
+ *
+ * A streaming summary of an integer stat over many sampled monsters: count,
+ * mean, standard deviation, range, and a histogram for quantiles.
+ *
+ * The histogram is exact until it holds VALUE_SKETCH_MAX_BUCKETS distinct
+ * values; past that, bucket widths double (1, 2, 4, ...) as often as needed
+ * to stay within that many buckets, so memory is fixed however many trials
+ * are added and quantiles are off by at most half a bucket. Sketches of the
+ * same stat merge exactly, whatever their widths, so sketches gathered by
+ * separate workers can be combined.
+ *
+**/
+
+#ifndef __VALUE_SKETCH_H__
+#define __VALUE_SKETCH_H__
+
+#include "AppHdr.h"
+
+#include <map>
+
+#define VALUE_SKETCH_MAX_BUCKETS 128
+
+class value_sketch
+{
+public:
+    value_sketch();
+
+    void add(long value);
+    void merge(const value_sketch &other);
+
+    long count() const { return n; }
+    long min() const { return lo; }
+    long max() const { return hi; }
+    double mean() const;
+    double stddev() const;
+    long quantile(double q) const;
+
+    std::string serialise() const;
+    bool deserialise(const std::string &data);
+
+private:
+    long n;
+    double sum, sum_sq;
+    long lo, hi;
+    // Bucket k counts the values in [k * width, (k + 1) * width).
+    long width;
+    std::map<long, long> buckets;
+
+    void rebucket(long new_width);
+};
+
+#endif
@@ -1,12 +0,0 @@
-/**
- * @file vault_monster_data.h
-**/
-
-#ifndef __VAULT_MONSTER_DATA_H__
-#define __VAULT_MONSTER_DATA_H__
-
-#include "AppHdr.h"
-
-std::vector<std::string> get_vault_monsters ();
-
-#endif
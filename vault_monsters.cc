@@ -5,89 +5,447 @@
  *
  * @section DESCRIPTION
  *
- * Parse the data created by parse_des.py and stored in vault_monster_data.cc,
+ * Parse the data extracted by --scan-des and stored in the vault monster pack,
  * and possibly return a monster spec if the provided name is actually the name
- * of a vault-defined monster.
+ * of a vault-defined monster. The names are resolved once at build time into
+ * the pack's name index, so that lookups don't need to place any monsters.
  *
 **/
 
 #include "AppHdr.h"
 
+#include "deadline.h"
 #include "dungeon.h"
 #include "env.h"
 #include "externs.h"
+#include "file_util.h"
 #include "mapdef.h"
 #include "message.h"
 #include "monster-main.h"
+#include "mon-util.h"
+#include "player.h"
 #include "stringutil.h"
-#include "vault_monster_data.h"
+#include "vault_monsters.h"
+#include "vault_pack.h"
+#include "version.h"
+
+#include <climits>
+#include <fcntl.h>
+#include <map>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VAULT_PACK_FILE "vault_monsters.pack"
+#define TILE_INFO_FILE "tile_info.txt"
+
+static vault_pack vault_monster_pack;
+
+static std::string normalise_vault_name(std::string name)
+{
+    name = replace_all_of(name, "'", "");
+    lowercase(name);
+    return name;
+}
+
+/**
+ * Parse a vault monster spec and find out what the resulting monster would
+ * be called, by placing it in the sandbox and removing it again.
+ *
+ * @param spec The spec string to parse.
+ * @param mspec Set to the parsed spec on success.
+ * @param name Set to the normalised display name on success.
+ * @return Whether the spec was valid and the monster could be placed.
+ *
+**/
+static bool resolve_vault_spec(const std::string &spec, mons_spec &mspec,
+                               std::string &name)
+{
+    mons_list mons;
+    const std::string err = mons.add_mons(spec, false);
+    if (!err.empty())
+        return false;
+
+    mspec = mons.get_monster(0);
+    const int index = mi_create_monster(mspec);
+    if (index < 0 || index >= MAX_MONSTERS)
+        return false;
+
+    monster *mp = &menv[index];
+    name = normalise_vault_name(mp->name(DESC_PLAIN, true));
+
+    const monster_type type = mp->type;
+    mons_remove_from_grid(mp);
+    mp->reset();
+    if (mons_is_unique(type))
+        you.unique_creatures.set(type, false);
+
+    return true;
+}
+
+/**
+ * Where to find a data file: $env_var if set, otherwise file next to the
+ * executable.
+ *
+**/
+static std::string data_file_path(const char *env_var, const char *file)
+{
+    const char *env_path = getenv(env_var);
+    if (env_path && *env_path)
+        return env_path;
+
+    char exe[PATH_MAX];
+    const ssize_t len = readlink("/proc/self/exe", exe, sizeof exe - 1);
+    if (len > 0)
+    {
+        exe[len] = 0;
+        const std::string dir(exe);
+        const std::string::size_type slash = dir.rfind('/');
+        if (slash != std::string::npos)
+            return dir.substr(0, slash + 1) + file;
+    }
+    return file;
+}
+
+static std::string vault_pack_path()
+{
+    return data_file_path("MONSTER_VAULT_PACK", VAULT_PACK_FILE);
+}
+
+/**
+ * Return the vault monster pack, mapping it on first use and picking up a
+ * regenerated pack on later calls.
+ *
+**/
+const vault_pack &current_vault_pack()
+{
+    static bool mapped = false;
+    if (!mapped)
+    {
+        mapped = true;
+        vault_monster_pack.load(vault_pack_path());
+    }
+    else
+        vault_monster_pack.reload_if_changed();
+
+    return vault_monster_pack;
+}
 
 /**
  * Return a vault-defined monster spec.
  *
- * This function parses the contents of (the generated) vault_monster_data.cc
- * and attempts to return a specification. If there is an invalid specification,
- * no error will be recorded.
+ * If the pack carries a name index generated by this build of crawl, this is
+ * a binary search of that index and no monsters are placed. Otherwise this
+ * instantiates the specs one by one until one has the right name, giving up
+ * when the query's deadline passes. If there is an invalid specification, no
+ * error will be recorded.
  *
- * @param monster_name Monster being searched for.  
+ * @param monster_name Monster being searched for.
+ * @param vault_spec If not NULL, set to the matching spec string, or to the
+ *                   empty string if there was no match.
  * @return A mons_spec instance that either contains the relevant data, or
  *         nothing if not found.
  *
 **/
 mons_spec get_vault_monster (std::string monster_name, std::string *vault_spec)
 {
-    lowercase(monster_name);
     trim_string(monster_name);
+    monster_name = normalise_vault_name(monster_name);
 
-    monster_name = replace_all_of(monster_name, "'", "");
+    mons_spec no_monster;
 
-    std::vector<std::string> monsters = get_vault_monsters();
+    if (vault_spec)
+        *vault_spec = "";
 
-    mons_list mons;
-    mons_spec no_monster;
+    const vault_pack &pack = current_vault_pack();
 
-    std::vector<std::string>::iterator it;
+    if (pack.index_count() > 0 && !strcmp(pack.version(), Version::Long))
+    {
+        const int spec = pack.find_index_spec(monster_name);
+        if (spec < 0)
+            return (no_monster);
+
+        mons_list mons;
+        if (!mons.add_mons(pack.spec(spec), false).empty())
+            return (no_monster);
 
-    for (it = monsters.begin(); it != monsters.end(); ++it)
+        if (vault_spec)
+            *vault_spec = pack.spec(spec);
+        return (mons.get_monster(0));
+    }
+
+    // Without an index every spec is resolved in turn, which is slow; give
+    // up if the query runs out of time.
+    for (int i = 0; i < pack.spec_count() && !deadline_expired(); ++i)
     {
-        mons.clear();
+        mons_spec this_mons;
+        std::string name;
+        if (resolve_vault_spec(pack.spec(i), this_mons, name)
+            && name == monster_name)
+        {
+            if (vault_spec)
+                *vault_spec = pack.spec(i);
+            return (this_mons);
+        }
+    }
 
-        const std::string err = mons.add_mons(*it, false);
-        if (err.empty())
+    return (no_monster);
+}
+
+/**
+ * Resolve the name of every vault-defined monster in a pack and rewrite the
+ * pack with a name index and the monster type names, stamped with this
+ * build's crawl version.
+ *
+ * Specs that fail to parse or place are dropped from the pack. Where several
+ * specs produce the same name the first spec (--scan-des writes them in
+ * sorted order) is indexed, so the output is stable.
+ *
+ * @param filename The pack to index.
+ * @return Whether the pack could be read and rewritten.
+ *
+**/
+bool write_vault_monster_index(const std::string &filename)
+{
+    std::vector<std::string> specs;
+    {
+        vault_pack pack;
+        if (!pack.load(filename))
         {
-            mons_spec this_mons = mons.get_monster(0);
-            int index = mi_create_monster(this_mons);
-
-            if (index < 0 || index >= MAX_MONSTERS)
-            {
-                continue;
-            }
-
-            bool this_spec = false;
-
-            monster *mp = &menv[index];
-
-            if (mp)
-            {
-                std::string name = replace_all_of(mp->name(DESC_PLAIN, true), "'","");
-                lowercase(name);
-                if (name == monster_name)
-                    this_spec = true;
-            }
-
-            mons_remove_from_grid(mp);
-
-            if (this_spec)
-            {
-                if (vault_spec)
-                    *vault_spec = *it;
-                return (this_mons);
-            }
+            fprintf(stderr, "Can't load vault monster pack: %s\n",
+                    filename.c_str());
+            return false;
         }
+        for (int i = 0; i < pack.spec_count(); ++i)
+            specs.push_back(pack.spec(i));
     }
 
-    if (vault_spec)
-        *vault_spec = "";
+    std::vector<std::string> valid_specs;
+    std::vector<std::pair<std::string, int> > index;
+    std::set<std::string> names;
 
-    return (no_monster);
+    for (unsigned int i = 0; i < specs.size(); ++i)
+    {
+        mons_spec mspec;
+        std::string name;
+        if (!resolve_vault_spec(specs[i], mspec, name))
+            continue;
+
+        valid_specs.push_back(specs[i]);
+        if (!name.empty() && names.insert(name).second)
+            index.push_back(std::make_pair(name, valid_specs.size() - 1));
+    }
+
+    return write_vault_pack(filename, valid_specs, index,
+                            monster_type_names(), Version::Long);
+}
+
+/**
+ * The name of every monster type, for name completion and suggestions.
+ * Needs crawl to be initialised.
+ *
+**/
+std::vector<std::string> monster_type_names()
+{
+    std::vector<std::string> names;
+    for (int i = 0; i < NUM_MONSTERS; ++i)
+    {
+        const monster_type mt = static_cast<monster_type>(i);
+        if (mt == MONS_PLAYER_GHOST || mt == MONS_PROGRAM_BUG
+            || invalid_monster_type(mt))
+        {
+            continue;
+        }
+        const monsterentry *me = get_monster_data(mt);
+        if (me && me->mc == mt)
+            names.push_back(mons_type_name(mt, DESC_PLAIN));
+    }
+    return names;
+}
+
+/**
+ * Read the monster tile list (rltiles/dc-mon.txt) into a map from tile
+ * enum name to image path, as parse_tiles.py used to.
+ *
+**/
+static bool read_tile_list(const std::string &filename,
+                           std::map<std::string, std::string> &tiles)
+{
+    FILE *in = fopen(filename.c_str(), "r");
+    if (!in)
+        return false;
+
+    std::string dir;
+    char buf[1024];
+    while (fgets(buf, sizeof buf, in))
+    {
+        std::string line = buf;
+        trim_string(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        if (line.compare(0, 5, "%sdir") == 0)
+        {
+            const std::string::size_type space = line.find(' ');
+            dir = space == std::string::npos ? "" : line.substr(space + 1);
+            continue;
+        }
+        if (line[0] == '%')
+            continue;
+
+        const std::string::size_type space = line.find(' ');
+        if (space == std::string::npos)
+            continue;
+
+        std::string image = line.substr(0, space);
+        if (!dir.empty() && image[0] != '/')
+            image = (dir[dir.size() - 1] == '/' ? dir : dir + "/") + image;
+        tiles[line.substr(space + 1)] = image + ".png";
+    }
+    fclose(in);
+    return true;
+}
+
+/**
+ * Write the table of vault monsters with their own tiles: one
+ * "name,image" line per monster, sorted by name. Each spec with a tile: is
+ * resolved to its monster's name in-process, and the tile looked up in the
+ * tile list. Where several specs produce the same name, the first one
+ * wins.
+ *
+ * @param tile_list The monster tile list, rltiles/dc-mon.txt.
+ * @param filename  The table to (re)write.
+ * @return Whether the table could be written.
+ *
+**/
+bool write_vault_tile_info(const std::string &tile_list,
+                           const std::string &filename)
+{
+    std::map<std::string, std::string> tiles;
+    if (!read_tile_list(tile_list, tiles))
+    {
+        fprintf(stderr, "Can't read tile list: %s\n", tile_list.c_str());
+        return false;
+    }
+
+    const vault_pack &pack = current_vault_pack();
+    if (!pack.loaded())
+    {
+        fprintf(stderr, "Can't load vault monster pack: %s\n",
+                vault_pack_path().c_str());
+        return false;
+    }
+
+    std::set<std::string> names;
+    std::map<std::string, std::string> table;
+    for (int i = 0; i < pack.spec_count(); ++i)
+    {
+        const std::string spec = pack.spec(i);
+        const std::string::size_type tile_pos = spec.find("tile:");
+        if (tile_pos == std::string::npos)
+            continue;
+
+        mons_spec mspec;
+        std::string name;
+        if (!resolve_vault_spec(spec, mspec, name)
+            || !names.insert(name).second)
+        {
+            continue;
+        }
+
+        std::string tile = spec.substr(tile_pos + 5);
+        tile = tile.substr(0, tile.find(' '));
+        uppercase(tile);
+        std::map<std::string, std::string>::const_iterator image =
+            tiles.find(tile);
+        if (image != tiles.end())
+            table[name] = image->second;
+    }
+
+    return write_file_atomically(filename, [&](FILE *out)
+    {
+        for (std::map<std::string, std::string>::const_iterator i =
+                 table.begin(); i != table.end(); ++i)
+        {
+            fprintf(out, "%s,%s\n", i->first.c_str(), i->second.c_str());
+        }
+    });
+}
+
+/**
+ * Binary search the "name,image" lines of a tile table, which
+ * write_vault_tile_info() writes sorted by name.
+ *
+ * @param data The table.
+ * @param size Its length in bytes.
+ * @param name The normalised monster name.
+ * @return The image path, or the empty string if name isn't in the table.
+ *
+**/
+static std::string search_tile_table(const char *data, size_t size,
+                                     const std::string &name)
+{
+    // [lo, hi) always covers whole lines.
+    size_t lo = 0, hi = size;
+    while (lo < hi)
+    {
+        size_t start = lo + (hi - lo) / 2;
+        while (start > lo && data[start - 1] != '\n')
+            --start;
+        const char *eol = static_cast<const char *>(
+            memchr(data + start, '\n', hi - start));
+        const size_t end = eol ? eol - data : hi;
+
+        const std::string line(data + start, end - start);
+        const std::string::size_type comma = line.rfind(',');
+        const int cmp = line.compare(0, comma, name);
+        if (cmp == 0)
+            return comma == std::string::npos ? "" : line.substr(comma + 1);
+        else if (cmp < 0)
+            lo = end + 1;
+        else
+            hi = start;
+    }
+    return "";
+}
+
+/**
+ * Look up a vault monster's tile in the table written by
+ * write_vault_tile_info(): tile_info.txt next to the executable, or
+ * $MONSTER_TILE_INFO. The table is mapped and binary searched, and this
+ * needs no crawl initialisation.
+ *
+ * @param monster_name The monster's name, in any case.
+ * @return The tile's image path, or the empty string if the monster has no
+ *         tile of its own (or there is no table).
+ *
+**/
+std::string find_vault_tile(std::string monster_name)
+{
+    trim_string(monster_name);
+    monster_name = normalise_vault_name(monster_name);
+
+    const int fd = open(data_file_path("MONSTER_TILE_INFO",
+                                       TILE_INFO_FILE).c_str(), O_RDONLY);
+    if (fd < 0)
+        return "";
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return "";
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return "";
+
+    const std::string image =
+        search_tile_table(static_cast<const char *>(map), st.st_size,
+                          monster_name);
+    munmap(map, st.st_size);
+    return image;
 }
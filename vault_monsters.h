@@ -7,6 +7,14 @@
 
 #include "AppHdr.h"
 
+class vault_pack;
+
 mons_spec get_vault_monster (std::string monster_name, std::string *vault_spec = 0);
+bool write_vault_monster_index(const std::string &filename);
+std::vector<std::string> monster_type_names();
+const vault_pack &current_vault_pack();
+bool write_vault_tile_info(const std::string &tile_list,
+                           const std::string &filename);
+std::string find_vault_tile(std::string monster_name);
 
 #endif
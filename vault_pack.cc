@@ -0,0 +1,372 @@
+/**
+ * @file vault_pack.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Read-only, memory-mapped access to the vault monster pack (see
+ * vault_pack.h), with support for picking up a regenerated pack without
+ * restarting.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "file_util.h"
+#include "stringutil.h"
+#include "vault_pack.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+vault_pack::vault_pack()
+    : file_dev(0), file_ino(0), file_mtime(0), file_size(0), loads(0),
+      map(NULL), map_size(0), header(NULL), spec_offsets(NULL), index(NULL),
+      type_name_offsets(NULL), strings(NULL)
+{
+}
+
+vault_pack::~vault_pack()
+{
+    unload();
+}
+
+void vault_pack::unload()
+{
+    if (map)
+        munmap(map, map_size);
+    map = NULL;
+    map_size = 0;
+    header = NULL;
+    spec_offsets = NULL;
+    index = NULL;
+    type_name_offsets = NULL;
+    strings = NULL;
+}
+
+/**
+ * Map a pack file, replacing any pack already loaded.
+ *
+ * @param pack_path The file to map.
+ * @return Whether the file exists and is a valid pack. If not, the object
+ *         is left empty.
+ *
+**/
+bool vault_pack::load(const std::string &pack_path)
+{
+    unload();
+    path = pack_path;
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0
+        || st.st_size < (off_t) sizeof(vault_pack_header))
+    {
+        close(fd);
+        return false;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        map = NULL;
+        return false;
+    }
+
+    map_size = st.st_size;
+    file_dev = st.st_dev;
+    file_ino = st.st_ino;
+    file_mtime = st.st_mtime;
+    file_size = st.st_size;
+
+    header = static_cast<const vault_pack_header *>(map);
+    const char *base = static_cast<const char *>(map);
+    spec_offsets =
+        reinterpret_cast<const uint32_t *>(base + header->specs_offset);
+    index = reinterpret_cast<const vault_pack_index_entry *>(
+        base + header->index_offset);
+    type_name_offsets =
+        reinterpret_cast<const uint32_t *>(base + header->type_names_offset);
+    strings = base + header->strings_offset;
+
+    if (!validate())
+    {
+        unload();
+        return false;
+    }
+    ++loads;
+    return true;
+}
+
+/**
+ * Reload the pack if the file has been replaced or modified since it was
+ * mapped. The generators replace the file atomically, so the old mapping
+ * stays valid until it is unmapped here.
+ *
+ * @return Whether a pack is loaded after the check.
+ *
+**/
+bool vault_pack::reload_if_changed()
+{
+    if (path.empty())
+        return false;
+
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0)
+        return loaded();
+
+    if (!loaded() || st.st_dev != file_dev || st.st_ino != file_ino
+        || st.st_mtime != file_mtime || st.st_size != file_size)
+    {
+        // Keep serving the old pack if the new one is broken.
+        vault_pack fresh;
+        if (!fresh.load(path))
+            return loaded();
+
+        unload();
+        std::swap(map, fresh.map);
+        std::swap(map_size, fresh.map_size);
+        std::swap(header, fresh.header);
+        std::swap(spec_offsets, fresh.spec_offsets);
+        std::swap(index, fresh.index);
+        std::swap(type_name_offsets, fresh.type_name_offsets);
+        std::swap(strings, fresh.strings);
+        file_dev = fresh.file_dev;
+        file_ino = fresh.file_ino;
+        file_mtime = fresh.file_mtime;
+        file_size = fresh.file_size;
+        ++loads;
+    }
+    return true;
+}
+
+static bool section_fits(uint32_t offset, uint64_t size, size_t map_size)
+{
+    return offset <= map_size && size <= map_size - offset;
+}
+
+bool vault_pack::validate() const
+{
+    if (header->magic != VAULT_PACK_MAGIC
+        || header->format != VAULT_PACK_FORMAT
+        || header->version[VAULT_PACK_VERSION_LENGTH - 1] != 0)
+    {
+        return false;
+    }
+
+    if (header->specs_offset % sizeof(uint32_t)
+        || header->index_offset % sizeof(uint32_t)
+        || header->type_names_offset % sizeof(uint32_t)
+        || !section_fits(header->specs_offset,
+                         (uint64_t) header->spec_count * sizeof(uint32_t),
+                         map_size)
+        || !section_fits(header->index_offset,
+                         (uint64_t) header->index_count
+                         * sizeof(vault_pack_index_entry),
+                         map_size)
+        || !section_fits(header->type_names_offset,
+                         (uint64_t) header->type_name_count
+                         * sizeof(uint32_t),
+                         map_size)
+        || !section_fits(header->strings_offset, header->strings_size,
+                         map_size))
+    {
+        return false;
+    }
+
+    // Every string must be NUL-terminated inside the table.
+    if (header->strings_size == 0
+        || strings[header->strings_size - 1] != 0)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header->spec_count; ++i)
+        if (spec_offsets[i] >= header->strings_size)
+            return false;
+
+    for (uint32_t i = 0; i < header->type_name_count; ++i)
+        if (type_name_offsets[i] >= header->strings_size)
+            return false;
+
+    for (uint32_t i = 0; i < header->index_count; ++i)
+    {
+        if (index[i].name >= header->strings_size
+            || index[i].spec >= header->spec_count
+            || i > 0 && strcmp(string_at(index[i - 1].name),
+                               string_at(index[i].name)) >= 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const char *vault_pack::string_at(uint32_t offset) const
+{
+    return strings + offset;
+}
+
+const char *vault_pack::version() const
+{
+    return header ? header->version : "";
+}
+
+int vault_pack::spec_count() const
+{
+    return header ? header->spec_count : 0;
+}
+
+const char *vault_pack::spec(int n) const
+{
+    return string_at(spec_offsets[n]);
+}
+
+int vault_pack::index_count() const
+{
+    return header ? header->index_count : 0;
+}
+
+const char *vault_pack::index_name(int n) const
+{
+    return string_at(index[n].name);
+}
+
+int vault_pack::index_spec(int n) const
+{
+    return index[n].spec;
+}
+
+/**
+ * Binary search the name index.
+ *
+ * @param name A normalised monster name.
+ * @return The number of the matching spec, or -1 if there is none.
+ *
+**/
+int vault_pack::find_index_spec(const std::string &name) const
+{
+    int lo = 0, hi = index_count();
+    while (lo < hi)
+    {
+        const int mid = lo + (hi - lo) / 2;
+        const int cmp = strcmp(index_name(mid), name.c_str());
+        if (cmp == 0)
+            return index_spec(mid);
+        else if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+int vault_pack::type_name_count() const
+{
+    return header ? header->type_name_count : 0;
+}
+
+/**
+ * The name of a monster type, as recorded when the pack was indexed. Only
+ * meaningful if the pack's version matches the running crawl.
+ *
+**/
+const char *vault_pack::type_name(int n) const
+{
+    return string_at(type_name_offsets[n]);
+}
+
+static uint32_t add_pack_string(std::string &table, const std::string &str)
+{
+    const uint32_t offset = table.size();
+    table += str;
+    table += '\0';
+    return offset;
+}
+
+/**
+ * Write a pack file. The file is written under a temporary name and then
+ * renamed into place, so that readers never see a partial pack.
+ *
+ * @param path    The pack file to (re)write.
+ * @param specs   The spec strings.
+ * @param index   (normalised name, spec number) pairs; need not be sorted,
+ *                but names must be unique.
+ * @param type_names The names of crawl's monster types.
+ * @param version The crawl version to record in the header.
+ * @return Whether the pack was written.
+ *
+**/
+bool write_vault_pack(const std::string &path,
+                      const std::vector<std::string> &specs,
+                      const std::vector<std::pair<std::string, int> > &index,
+                      const std::vector<std::string> &type_names,
+                      const std::string &version)
+{
+    std::vector<std::pair<std::string, int> > sorted_index(index);
+    std::sort(sorted_index.begin(), sorted_index.end());
+
+    std::string strings;
+    std::vector<uint32_t> spec_offsets;
+    for (unsigned int i = 0; i < specs.size(); ++i)
+        spec_offsets.push_back(add_pack_string(strings, specs[i]));
+
+    std::vector<vault_pack_index_entry> entries;
+    for (unsigned int i = 0; i < sorted_index.size(); ++i)
+    {
+        vault_pack_index_entry entry;
+        entry.name = add_pack_string(strings, sorted_index[i].first);
+        entry.spec = sorted_index[i].second;
+        entries.push_back(entry);
+    }
+
+    std::vector<uint32_t> type_name_offsets;
+    for (unsigned int i = 0; i < type_names.size(); ++i)
+        type_name_offsets.push_back(add_pack_string(strings, type_names[i]));
+    if (strings.empty())
+        strings += '\0';
+
+    vault_pack_header header;
+    memset(&header, 0, sizeof header);
+    header.magic = VAULT_PACK_MAGIC;
+    header.format = VAULT_PACK_FORMAT;
+    header.spec_count = spec_offsets.size();
+    header.index_count = entries.size();
+    header.type_name_count = type_name_offsets.size();
+    header.specs_offset = sizeof header;
+    header.index_offset =
+        header.specs_offset + spec_offsets.size() * sizeof(uint32_t);
+    header.type_names_offset =
+        header.index_offset + entries.size() * sizeof(vault_pack_index_entry);
+    header.strings_offset = header.type_names_offset
+                            + type_name_offsets.size() * sizeof(uint32_t);
+    header.strings_size = strings.size();
+    strncpy(header.version, version.c_str(), VAULT_PACK_VERSION_LENGTH - 1);
+
+    return write_file_atomically(path, [&](FILE *out)
+    {
+        fwrite(&header, sizeof header, 1, out);
+        if (!spec_offsets.empty())
+        {
+            fwrite(&spec_offsets[0], sizeof(uint32_t), spec_offsets.size(),
+                   out);
+        }
+        if (!entries.empty())
+        {
+            fwrite(&entries[0], sizeof(vault_pack_index_entry),
+                   entries.size(), out);
+        }
+        if (!type_name_offsets.empty())
+        {
+            fwrite(&type_name_offsets[0], sizeof(uint32_t),
+                   type_name_offsets.size(), out);
+        }
+        fwrite(strings.data(), 1, strings.size(), out);
+    });
+}
@@ -0,0 +1,117 @@
+/**
+ * @file vault_pack.h
+ *
+ * @section DESCRIPTION
+ *
+ * The vault monster pack is a compact binary file holding every
+ * vault-defined monster spec (extracted by monster-trunk --scan-des),
+ * optionally followed by a name index resolved by monster-trunk
+ * --vault-index. The indexing step also records the name of every monster
+ * type, so that name completion and suggestions don't need crawl to be
+ * initialised.
+ *
+ * Layout (all integers are native-endian uint32_t):
+ *
+ *     header          vault_pack_header
+ *     spec offsets    spec_count offsets into the string table
+ *     index           index_count (name offset, spec number) pairs, sorted
+ *                     by name (strcmp order)
+ *     type names      type_name_count offsets into the string table
+ *     string table    NUL-terminated strings
+ *
+ * The pack is mapped read-only and specs are handed out as pointers into
+ * the mapping, so nothing is copied or allocated per spec.
+ *
+**/
+
+#ifndef __VAULT_PACK_H__
+#define __VAULT_PACK_H__
+
+#include "AppHdr.h"
+
+#include <sys/types.h>
+
+#define VAULT_PACK_MAGIC 0x4b50564d // "MVPK"
+#define VAULT_PACK_FORMAT 2
+#define VAULT_PACK_VERSION_LENGTH 64
+
+struct vault_pack_header
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t spec_count;
+    uint32_t index_count;
+    uint32_t type_name_count;
+    uint32_t specs_offset;
+    uint32_t index_offset;
+    uint32_t type_names_offset;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    // Crawl version the specs (and index and type names, if any) were
+    // generated from.
+    char version[VAULT_PACK_VERSION_LENGTH];
+};
+
+struct vault_pack_index_entry
+{
+    uint32_t name;
+    uint32_t spec;
+};
+
+class vault_pack
+{
+public:
+    vault_pack();
+    ~vault_pack();
+
+    bool load(const std::string &path);
+    bool reload_if_changed();
+    void unload();
+
+    bool loaded() const { return header != NULL; }
+    const char *version() const;
+    // Changes whenever another pack is mapped, so that anything derived
+    // from the pack can tell when to rebuild.
+    int generation() const { return loads; }
+
+    int spec_count() const;
+    const char *spec(int n) const;
+
+    int index_count() const;
+    const char *index_name(int n) const;
+    int index_spec(int n) const;
+    int find_index_spec(const std::string &name) const;
+
+    int type_name_count() const;
+    const char *type_name(int n) const;
+
+private:
+    vault_pack(const vault_pack &);
+    vault_pack &operator = (const vault_pack &);
+
+    bool validate() const;
+    const char *string_at(uint32_t offset) const;
+
+    std::string path;
+    dev_t file_dev;
+    ino_t file_ino;
+    time_t file_mtime;
+    off_t file_size;
+    int loads;
+
+    void *map;
+    size_t map_size;
+    const vault_pack_header *header;
+    const uint32_t *spec_offsets;
+    const vault_pack_index_entry *index;
+    const uint32_t *type_name_offsets;
+    const char *strings;
+};
+
+bool write_vault_pack(const std::string &path,
+                      const std::vector<std::string> &specs,
+                      const std::vector<std::pair<std::string, int> > &index,
+                      const std::vector<std::string> &type_names,
+                      const std::string &version);
+
+#endif